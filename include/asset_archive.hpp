@@ -0,0 +1,83 @@
+#ifndef ASSET_ARCHIVE_HPP__
+#define ASSET_ARCHIVE_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <gl_utils.hpp>
+#include <mapped_file.hpp>
+
+namespace gl
+{
+	// Everything the game loads from res/ cooked into one file (.kpak, see
+	// tools/cook.cpp and `make cook`): textures as premultiplied RGBA8 with
+	// an optional mip chain, shaders and maps as they are. The archive is
+	// mapped copy-on-write and nothing is read until it is used, textures are
+	// uploaded straight from the mapping.
+	class AssetArchive
+	{
+	public:
+		enum Type : std::uint32_t
+		{
+			raw = 0,
+			texture = 1,
+		};
+
+		struct Entry
+		{
+			Type type;
+			// textures only, levels of RGBA8 halving down to 1x1
+			std::uint32_t width, height, levels;
+			std::size_t offset, size;
+			const unsigned char* data;
+		};
+
+		AssetArchive() = default;
+		// Opens the archive if there is one.
+		explicit AssetArchive(const std::string& filename);
+
+		// Returns false when the file does not exist, throws when it is not
+		// an archive. Every entry records the file it was cooked from and its
+		// mtime, entries whose source changed since are left out with a
+		// warning, so edited assets load from their files until the next
+		// cook. A source that is gone keeps its entry.
+		bool open(const std::string& filename);
+		bool is_open() const { return file_ != nullptr; }
+
+		// Cooked under the path it has in the source tree, e.g. "res/grass.png".
+		const Entry* find(const std::string& name) const;
+		bool read(const std::string& name, std::string& out) const;
+
+		// Uploads every level of a texture entry, the texture keeps its
+		// wrap and filter settings.
+		void load_texture(const Entry& entry, Texture2D& texture) const;
+
+		const std::shared_ptr<MappedFile>& file() const { return file_; }
+		std::size_t size() const { return entries_.size(); }
+	private:
+		std::shared_ptr<MappedFile> file_;
+		std::unordered_map<std::string, Entry> entries_;
+	};
+
+	// One asset as the cooker writes it.
+	struct CookedAsset
+	{
+		std::string name;
+		AssetArchive::Type type = AssetArchive::raw;
+		std::uint32_t width = 0, height = 0, levels = 0;
+		std::vector<unsigned char> data;
+		// the file it was cooked from, e.g. "xmlova.tmx" for "xmlova.kmap",
+		// and its file_mtime() when it was read
+		std::string source;
+		std::int64_t source_mtime = -1;
+	};
+
+	// Assets with identical data are stored once.
+	void save_asset_archive(const std::vector<CookedAsset>& assets, const std::string& filename);
+}
+
+#endif
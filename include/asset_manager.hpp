@@ -0,0 +1,142 @@
+#ifndef ASSET_MANAGER_HPP__
+#define ASSET_MANAGER_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <asset_archive.hpp>
+#include <gl_utils.hpp>
+#include <texture_loader.hpp>
+
+namespace gl
+{
+	class AssetManager;
+
+	// One texture owned by the AssetManager, shared by every path whose file
+	// has the same content.
+	struct TextureAsset
+	{
+		std::string path;            // the first path it was requested by
+		std::uint64_t hash;          // of the PNG file
+		std::vector<unsigned char> png;
+		// uploaded from the archive instead, `png` stays empty
+		const AssetArchive::Entry* cooked = nullptr;
+		Texture2D texture;
+
+		int refs = 0;                // live TextureHandles
+		bool resident = false;       // on the GPU or queued to get there
+		std::uint64_t last_used = 0; // AssetManager frame
+
+		std::size_t cpu_bytes() const { return png.size(); }
+		std::size_t gpu_bytes() const {
+			return mip_chain_size(texture.width, texture.height, texture.levels);
+		}
+		// queued in the loader, the texture has to stay
+		bool loading() const { return resident && !texture.ready && !texture.invalid; }
+
+		std::list<TextureAsset>::iterator lru_;
+	};
+
+	// Reference counted handle to a texture of an AssetManager, which has to
+	// outlive it. Dereferencing marks the texture as used this frame and
+	// queues it again when it was evicted, it shows the loader's placeholder
+	// until it is back.
+	class TextureHandle
+	{
+	public:
+		TextureHandle() = default;
+		~TextureHandle();
+
+		TextureHandle(const TextureHandle& other);
+		TextureHandle(TextureHandle&& other);
+		TextureHandle& operator=(TextureHandle other);
+
+		explicit operator bool() const { return asset_ != nullptr; }
+
+		Texture2D& operator*() const;
+		Texture2D* operator->() const { return &**this; }
+
+		const TextureAsset* asset() const { return asset_; }
+	private:
+		friend class AssetManager;
+
+		TextureHandle(AssetManager* manager, TextureAsset* asset);
+
+		AssetManager* manager_ = nullptr;
+		TextureAsset* asset_ = nullptr;
+	};
+
+	// Owns the game's textures. A path is read once, files with the same
+	// content share one texture, and the PNGs stay in memory so a texture
+	// evicted from VRAM is decoded again without touching the disk. Paths
+	// found in the archive are uploaded from it without decoding.
+	//
+	//   TextureHandle player = assets.texture("res/player.png");
+	//   sprites.draw_sprite(*player, pos);
+	//   ...
+	//   assets.update();  // every frame, after drawing
+	//
+	// When the textures take more than `vram_budget` bytes, update() evicts
+	// the least recently used ones that were not drawn this frame. Textures
+	// nothing refers to any more are dropped, the others shrink to the
+	// placeholder until they are used again.
+	class AssetManager
+	{
+	public:
+		struct Stats
+		{
+			std::size_t textures = 0;
+			std::size_t resident = 0;
+			std::size_t cpu_bytes = 0;
+			std::size_t gpu_bytes = 0;
+			// requests served by a texture that was already there, by path
+			// and by content
+			std::size_t path_hits = 0;
+			std::size_t content_hits = 0;
+			std::size_t evictions = 0;
+		};
+
+		std::size_t vram_budget;
+
+		// The archive has to outlive the manager.
+		explicit AssetManager(TextureLoader& loader, const AssetArchive* archive = nullptr,
+		                      std::size_t vram_budget = 256 << 20);
+		// waits for the loader, it may still hold textures of this manager
+		~AssetManager();
+
+		AssetManager(const AssetManager& other) = delete;
+		AssetManager& operator=(const AssetManager& other) = delete;
+
+		// Shared texture of the PNG at `path`, loaded through the
+		// TextureLoader. An unreadable file keeps the placeholder.
+		TextureHandle texture(const std::string& path);
+
+		// Evicts textures over the budget and starts the next frame.
+		void update();
+
+		Stats stats() const;
+		// most recently used first
+		const std::list<TextureAsset>& textures() const { return lru_; }
+	private:
+		friend class TextureHandle;
+
+		TextureLoader& loader_;
+		const AssetArchive* archive_;
+		std::uint64_t frame_ = 1;
+		std::size_t path_hits_ = 0, content_hits_ = 0, evictions_ = 0;
+
+		std::list<TextureAsset> lru_;
+		std::unordered_map<std::string, TextureAsset*> by_path_;
+		std::unordered_multimap<std::uint64_t, TextureAsset*> by_hash_;
+
+		TextureAsset& use_(TextureAsset& asset);
+		void upload_(TextureAsset& asset);
+		void evict_(TextureAsset& asset);
+	};
+}
+
+#endif
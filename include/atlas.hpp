@@ -0,0 +1,122 @@
+#ifndef ATLAS_HPP__
+#define ATLAS_HPP__
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <gl_utils.hpp>
+
+namespace gl
+{
+	struct AtlasRegion
+	{
+		int page;                // -1 for a layer of TextureAtlas::tiles
+		int slice;               // that layer
+		int x, y, width, height; // in pixels, without the padding
+		glm::vec4 uv;            // left, top, right, bottom
+	};
+
+	// Packs images into one or more RGBA8 pages with stb_rect_pack. Images of
+	// the tile size go into the layers of a texture array instead. Packing
+	// and composing happens on the CPU only, the GL side is TextureAtlas.
+	class AtlasBuilder
+	{
+	public:
+		int page_width, page_height;
+		int padding;
+
+		std::unordered_map<int, AtlasRegion> regions;
+		int page_count = 0;
+		// rows of every page in use, rounded up to a power of two, so a page
+		// holding a few images does not take a whole page of VRAM
+		std::vector<int> page_heights;
+
+		// images of exactly this size are layers of the tile array, none
+		// while 0
+		int tile_width = 0, tile_height = 0;
+		int tile_count = 0;
+
+		explicit AtlasBuilder(int page_width = 1024, int page_height = 1024, int padding = 1);
+
+		// Reserves space for an image without any pixel data, compose() leaves
+		// the region transparent.
+		void add(int id, int width, int height);
+		void add(int id, int width, int height, std::vector<unsigned char> pixels);
+		bool add_png(int id, const std::string& filename);
+
+		// Assigns every added image a region, opening new pages as needed.
+		void pack();
+
+		// RGBA8 pixels of every page, padding filled by extruding the edges of
+		// each image so that linear filtering does not bleed between tiles.
+		std::vector<std::vector<unsigned char>> compose() const;
+		// Mip chains (see build_mip_chain) of the tile_count tiles, one
+		// layer after another.
+		std::vector<unsigned char> compose_tiles() const;
+
+	private:
+		struct Image
+		{
+			int id;
+			int width, height;
+			std::vector<unsigned char> pixels;
+		};
+
+		std::vector<Image> images_;
+
+		bool is_tile_(const Image& image) const {
+			return tile_width > 0 && image.width == tile_width && image.height == tile_height;
+		}
+	};
+
+	// Copies an image into `dst` (the top left of its padded rectangle, rows
+	// `stride` pixels apart) with its edges extruded into the padding.
+	void extrude_image(const unsigned char* pixels, int width, int height, int padding,
+		unsigned char* dst, std::size_t stride);
+
+	class TextureAtlas
+	{
+	public:
+		// size of the pages insert() opens, unless an image needs more
+		static const int late_page_size = 256;
+
+		// single level, the mips of a packed page would bleed between its
+		// images once they shrink below the padding
+		std::vector<Texture2D> pages;
+		// images of the tile size, drawn by layer without any bleeding, with
+		// full mip chains so zoomed out maps sample the small levels
+		Texture2DArray tiles;
+		std::unordered_map<int, AtlasRegion> regions;
+		int padding = 1;
+		// bumped by insert(), geometry built while a region was missing is
+		// out of date when it changed
+		unsigned revision = 0;
+
+		void load(const AtlasBuilder& builder);
+
+		// Adds an image after load(), into a free layer of the tile array
+		// when it has the tile size, growing the array when it is full,
+		// otherwise shelf packed into pages of its
+		// own so the existing regions stay where they are. Uploads only the
+		// new region.
+		const AtlasRegion& insert(int id, int width, int height, const unsigned char* pixels);
+
+		const AtlasRegion* find(int id) const;
+		Texture2D& page(const AtlasRegion& region) { return pages[region.page]; }
+
+		// GPU memory of the pages and the tile array.
+		std::size_t gpu_bytes() const;
+	private:
+		int tile_width_ = 0, tile_height_ = 0;
+		int tiles_used_ = 0;
+		// the page insert() fills, -1 before the first insert
+		int late_page_ = -1;
+		int shelf_x_ = 0, shelf_y_ = 0, shelf_height_ = 0;
+
+		// Doubles the layers of the tile array, false when it cannot grow.
+		bool grow_tiles_();
+	};
+}
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef BINARY_IO_HPP
+#define BINARY_IO_HPP
+
+#include <cstdint>
+#include <ostream>
+
+// Helpers for the little-endian binary files the tools write and the game
+// maps (.kmap, .kpak).
+
+inline bool little_endian() {
+	const uint16_t one = 1;
+	return *(const unsigned char*)&one == 1;
+}
+
+inline uint32_t swap32(uint32_t v) {
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+}
+
+inline uint64_t swap64(uint64_t v) {
+	return ((uint64_t)swap32((uint32_t)v) << 32) | swap32((uint32_t)(v >> 32));
+}
+
+// Converts between file and host order, the same both ways.
+template <typename T>
+void fix_endian(T& v) {
+	if (little_endian()) return;
+	v = sizeof(T) == 8 ? (T)swap64((uint64_t)v) : (T)swap32((uint32_t)v);
+}
+
+template <typename T>
+void write_pod(std::ostream& out, T value) {
+	fix_endian(value);
+	out.write((const char*)&value, sizeof(value));
+}
+
+#endif /* BINARY_IO_HPP */
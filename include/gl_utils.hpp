@@ -1,10 +1,13 @@
 #ifndef GL_UTILS_HPP__
 #define GL_UTILS_HPP__
 
+#include <cstdint>
 #include <functional>
 #include <tuple>
 #include <vector>
 #include <map>
+#include <string>
+#include <unordered_map>
 
 #include <glad/glad.h>
 
@@ -17,8 +20,43 @@
 
 float rad_for_hex(int i);
 
+// ARB_buffer_storage (core in 4.4), glad is generated for 4.1 only.
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+#endif
+
+// ARB_texture_storage (core in 4.2).
+#ifndef GL_TEXTURE_IMMUTABLE_FORMAT
+#define GL_TEXTURE_IMMUTABLE_FORMAT 0x912F
+typedef void (APIENTRYP PFNGLTEXSTORAGE2DPROC)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height);
+typedef void (APIENTRYP PFNGLTEXSTORAGE3DPROC)(GLenum target, GLsizei levels, GLenum internalformat, GLsizei width, GLsizei height, GLsizei depth);
+#endif
+
 namespace gl
 {
+	// Entry points newer than the 4.1 core profile glad loads. They stay null
+	// when the driver does not provide them.
+	struct Extensions
+	{
+		PFNGLBUFFERSTORAGEPROC buffer_storage = nullptr;
+		PFNGLTEXSTORAGE2DPROC tex_storage_2d = nullptr;
+		PFNGLTEXSTORAGE3DPROC tex_storage_3d = nullptr;
+	};
+
+	extern Extensions ext;
+
+	// Call once after gladLoadGLLoader with the same loader.
+	void load_extensions(GLADloadproc load);
+	bool has_extension(const char* name);
+
+	inline bool intersects(const glm::vec4& a, const glm::vec4& b) {
+		return a.x < b.z && b.x < a.z && a.y < b.w && b.y < a.w;
+	}
+
 	class Camera
 	{
 		glm::mat4 projection_{1};
@@ -30,6 +68,8 @@ namespace gl
 
 		const float scroll_offset = 0.05f;
 	public:
+		Camera() = default;
+		explicit Camera(float zoom_level): zoom_level_(zoom_level) {}
 
 		void update_camera();
 		void update_and_load_camera();
@@ -37,25 +77,73 @@ namespace gl
 		glm::mat4 projection() const;
 		float* value_ptr();
 
+		// World space rectangle (left, top, right, bottom) seen through
+		// projection() * base, where base maps the world to clip space.
+		glm::vec4 visible_rect(const glm::mat4& base = glm::mat4(1)) const;
+
 		void keydown(Sint32 key);
 		void keyup(Sint32 key);
 		void scroll(Sint32 direction);
 	};
 
+	// Shadow copy of the GL binding state. All wrappers below bind through it,
+	// so a bind of an object that is already bound never reaches the driver.
+	// Code that touches GL state behind its back must call invalidate().
+	class StateCache
+	{
+	public:
+		static const int max_texture_units = 16;
+
+		// Since the last reset_counters(), normally once per frame.
+		int binds_issued = 0;
+		int binds_elided = 0;
+
+		StateCache();
+
+		void use_program(GLuint program);
+		void bind_vertex_array(GLuint vao);
+		void bind_buffer(GLenum target, GLuint buffer);
+		void active_texture(GLenum unit);
+		// Binds to the active texture unit.
+		void bind_texture(GLenum target, GLuint texture);
+
+		// Called when an object is deleted, GL unbinds it implicitly.
+		void forget_program(GLuint program);
+		void forget_vertex_array(GLuint vao);
+		void forget_buffer(GLuint buffer);
+		void forget_texture(GLuint texture);
+
+		void invalidate();
+		void reset_counters();
+
+	private:
+		static const GLuint unknown = ~0u;
+
+		GLuint program_;
+		GLuint vertex_array_;
+		GLenum active_unit_;
+		std::map<GLenum, GLuint> buffers_;
+		std::map<GLenum, GLuint> textures_[max_texture_units];
+
+		bool elide_(GLuint& current, GLuint value);
+	};
+
+	StateCache& state_cache();
+
 	class VAO
 	{
 	public:
 		GLuint id;
 		VAO() { glGenVertexArrays(1, &id); bind(); }
-		~VAO() { glDeleteVertexArrays(1, &id); }
+		~VAO() { state_cache().forget_vertex_array(id); glDeleteVertexArrays(1, &id); }
 
 		VAO(const VAO& other) = delete;
 		VAO(VAO&& other) = delete;
 		VAO& operator=(const VAO& other) = delete;
 		VAO& operator=(VAO&& other) = delete;
 
-		void bind() const { glBindVertexArray(id); }
-		void unbind() const { glBindVertexArray(0); }
+		void bind() const { state_cache().bind_vertex_array(id); }
+		void unbind() const { state_cache().bind_vertex_array(0); }
 	};
 
 	class VBO
@@ -64,17 +152,92 @@ namespace gl
 		GLuint id;
 
 		VBO() { glGenBuffers(1, &id); bind(); }
-		~VBO() { glDeleteBuffers(1, &id); }
+		~VBO() { state_cache().forget_buffer(id); glDeleteBuffers(1, &id); }
 
 		VBO(const VBO& other) = delete;
 		VBO(VBO&& other) = delete;
 		VBO& operator=(const VBO& other) = delete;
 		VBO& operator=(VBO&& other) = delete;
 
-		void bind() const { glBindBuffer(GL_ARRAY_BUFFER, id); }
-		void unbind() const { glBindBuffer(GL_ARRAY_BUFFER, 0); }
+		void bind() const { state_cache().bind_buffer(GL_ARRAY_BUFFER, id); }
+		void unbind() const { state_cache().bind_buffer(GL_ARRAY_BUFFER, 0); }
 	};
 
+	// Ring buffer for vertex data that is rebuilt every frame. Data is appended
+	// behind the previous writes instead of reallocating the buffer. With
+	// buffer storage the whole ring stays persistently mapped and fences keep
+	// the CPU from overwriting a region the GPU still reads; otherwise each
+	// write maps its range unsynchronized and the buffer is orphaned when the
+	// ring wraps around.
+	class StreamBuffer
+	{
+	public:
+		GLuint id;
+		GLenum target;
+		GLsizeiptr size;
+
+		explicit StreamBuffer(GLsizeiptr size = 4 << 20, GLenum target = GL_ARRAY_BUFFER);
+		~StreamBuffer();
+
+		StreamBuffer(const StreamBuffer& other) = delete;
+		StreamBuffer(StreamBuffer&& other) = delete;
+		StreamBuffer& operator=(const StreamBuffer& other) = delete;
+		StreamBuffer& operator=(StreamBuffer&& other) = delete;
+
+		// Copies the data into the ring and returns its byte offset in the
+		// buffer. The offset is a multiple of `alignment`, pass the vertex size
+		// to be able to use offset / stride as the first vertex of a draw.
+		GLintptr write(const void* data, GLsizeiptr bytes, GLsizeiptr alignment = 4);
+
+		bool persistent() const { return mapped_ != nullptr; }
+		// The ring is guarded by one fence per quarter of the buffer, a
+		// segment has one while the GPU may still read what was written to it.
+		static const int segment_count = 4;
+		bool fenced(int segment) const { return fences_[segment] != nullptr; }
+
+		void bind() const { state_cache().bind_buffer(target, id); }
+	private:
+		unsigned char* mapped_ = nullptr;
+		GLsizeiptr head_ = 0;
+		GLsync fences_[segment_count] = {};
+		// segments written since they were last fenced, [begin, end)
+		int unfenced_begin_ = 0, unfenced_end_ = 0;
+
+		int segment_(GLsizeiptr offset) const { return (int)(offset * segment_count / size); }
+		void fence_(int segment);
+		void wait_(int segment);
+	};
+
+	// Shared GL_ELEMENT_ARRAY_BUFFER for quads stored as 4 vertices each
+	// (corners in order), indices 0 1 2 0 2 3, 4 5 6 4 6 7, ... Element buffer
+	// bindings are VAO state, bind() it with the VAO bound.
+	class QuadIndexBuffer
+	{
+	public:
+		// quads per draw call, the last index still fits GLushort
+		static const GLsizei max_quads = 16384;
+
+		GLuint id;
+
+		QuadIndexBuffer();
+		~QuadIndexBuffer();
+
+		QuadIndexBuffer(const QuadIndexBuffer& other) = delete;
+		QuadIndexBuffer(QuadIndexBuffer&& other) = delete;
+		QuadIndexBuffer& operator=(const QuadIndexBuffer& other) = delete;
+		QuadIndexBuffer& operator=(QuadIndexBuffer&& other) = delete;
+
+		void bind() const { state_cache().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, id); }
+
+		// Draws `count` quads whose first vertex is `first_vertex` in the bound
+		// vertex buffers, split into several draws above max_quads. Returns
+		// the number of draw calls.
+		int draw(GLint first_vertex, GLsizei count) const;
+	};
+
+	// Created on first use, needs a current GL context.
+	QuadIndexBuffer& quad_indices();
+
 	class TextureID {
 	public:
 		GLuint id;
@@ -90,19 +253,49 @@ namespace gl
 			return *this;
 		}
 
-		~TextureID() { if (id != -1) glDeleteTextures(1, &id); }
+		~TextureID() {
+			if (id != -1) {
+				state_cache().forget_texture(id);
+				glDeleteTextures(1, &id);
+			}
+		}
 
 		operator GLuint() const { return id; }
 	};
 
+	// Multiplies the color of RGBA8 pixels by their alpha. Every texture the
+	// game draws is premultiplied, blended with GL_ONE, GL_ONE_MINUS_SRC_ALPHA,
+	// so filtering and mip levels do not bleed the color of transparent
+	// texels into their neighbours.
+	void premultiply_alpha(unsigned char* pixels, std::size_t count);
+
+	// Levels of a full mip chain, halving down to 1x1.
+	std::uint32_t mip_levels(std::uint32_t width, std::uint32_t height);
+	// Bytes of the first `levels` levels of an RGBA8 image.
+	std::size_t mip_chain_size(std::uint32_t width, std::uint32_t height, std::uint32_t levels);
+
+	// RGBA8 pixels followed by their box filtered mip levels down to 1x1.
+	std::vector<unsigned char> build_mip_chain(const std::vector<unsigned char>& pixels,
+		std::uint32_t width, std::uint32_t height, std::uint32_t& levels);
+
 	class Texture2D
 	{
 	public:
 		TextureID id;
 		GLuint width, height, internal_format, image_format;
+		// type of the data passed to load(), e.g. GL_INT for GL_R32I
+		GLuint pixel_type;
 		GLuint wrap_s, wrap_t, filter_min, filter_mag;
+		// mip levels, filtered trilinear when there is more than one
+		GLuint levels = 1;
+		// storage of a fixed size from load_levels(), loading into it again
+		// creates a new texture object (and id)
+		bool immutable = false;
 
 		bool invalid = false;
+		// set by load(), TextureLoader clears it while the texture only has
+		// its placeholder
+		bool ready = false;
 
 		Texture2D();
 		~Texture2D() = default;
@@ -114,15 +307,87 @@ namespace gl
 		Texture2D& operator=(Texture2D&&) = default;
 
 		void load_png(const std::string& filename);
+		// With a GL_PIXEL_UNPACK_BUFFER bound `data` is an offset into it.
 		void load(GLuint width, GLuint height, unsigned char* data);
+		// Immutable storage (glTexStorage2D where there is one) for a mip
+		// chain laid out like build_mip_chain(), uploaded level by level.
+		// `data` may be an unpack buffer offset as well.
+		void load_levels(GLuint width, GLuint height, GLuint levels, const unsigned char* data);
 		void bind() const;
 	};
 
+	// Images of one size as the layers of a GL_TEXTURE_2D_ARRAY. A layer is
+	// sampled on its own, so unlike in an atlas page nothing bleeds in from
+	// its neighbours and it needs no padding.
+	class Texture2DArray
+	{
+	public:
+		TextureID id;
+		GLuint width, height, layers, internal_format, image_format;
+		GLuint wrap_s, wrap_t, filter_min, filter_mag;
+		// of every layer, filtered trilinear when there is more than one
+		GLuint levels = 1;
+
+		Texture2DArray();
+
+		Texture2DArray(const Texture2DArray&) = delete;
+		Texture2DArray& operator=(const Texture2DArray&) = delete;
+
+		Texture2DArray(Texture2DArray&& t) = default;
+		Texture2DArray& operator=(Texture2DArray&&) = default;
+
+		// Immutable storage where the driver has it. `data` holds the mip
+		// chain of every layer (see build_mip_chain) one after another, or is
+		// null to leave them undefined.
+		void load(GLuint width, GLuint height, GLuint layers, GLuint levels, const unsigned char* data);
+		// `data` is the mip chain of the layer.
+		void load_layer(GLuint layer, const unsigned char* data);
+		// Reallocates a loaded array with room for `layers` and copies the ones it
+		// keeps over on the GPU. The texture object is a new one afterwards.
+		// An array that was never loaded only gets storage of its width,
+		// height and levels.
+		void resize(GLuint layers);
+		void bind() const;
+	};
+
+	// Location of a uniform, resolved once when the program is linked.
+	struct Uniform
+	{
+		GLint location = -1;
+
+		Uniform() = default;
+		explicit Uniform(GLint location): location(location) {}
+
+		bool valid() const { return location != -1; }
+	};
+
+	// Reads the source of a shader file into `code`, returns false when the
+	// file should be read from disk instead.
+	using ShaderReader = std::function<bool(const std::string& path, std::string& code)>;
+
+	// Shaders compiled while it lives get their sources from `reader` first,
+	// e.g. from an AssetArchive. The previous reader is restored afterwards.
+	class ShaderSources
+	{
+	public:
+		explicit ShaderSources(ShaderReader reader);
+		~ShaderSources();
+
+		ShaderSources(const ShaderSources& other) = delete;
+		ShaderSources& operator=(const ShaderSources& other) = delete;
+	private:
+		ShaderReader previous_;
+	};
+
 	class Shader
 	{
 	public:
 		GLuint program;
 
+		// name -> location of every active uniform, filled after linking.
+		// Arrays are reachable both as "name" and "name[0]".
+		std::unordered_map<std::string, GLint> uniforms;
+
 		explicit Shader(std::string name);
 		Shader(std::string vertex, std::string fragment);
 
@@ -133,19 +398,121 @@ namespace gl
 
 		~Shader();
 
-		void set(const GLchar* name, int value);
-		void set(const GLchar* name, float value);
-		void set(const GLchar* name, const glm::vec2& v);
-		void set(const GLchar* name, const glm::vec3& v);
-		void set(const GLchar* name, const glm::vec4& v);
-		void set(const GLchar* name, const glm::mat4& matrix);
+		Uniform uniform(const GLchar* name) const;
+
+		void set(Uniform uniform, int value);
+		void set(Uniform uniform, float value);
+		void set(Uniform uniform, const glm::vec2& v);
+		void set(Uniform uniform, const glm::vec3& v);
+		void set(Uniform uniform, const glm::vec4& v);
+		void set(Uniform uniform, const glm::mat4& matrix);
+
+		void set(const GLchar* name, int value) { set(uniform(name), value); }
+		void set(const GLchar* name, float value) { set(uniform(name), value); }
+		void set(const GLchar* name, const glm::vec2& v) { set(uniform(name), v); }
+		void set(const GLchar* name, const glm::vec3& v) { set(uniform(name), v); }
+		void set(const GLchar* name, const glm::vec4& v) { set(uniform(name), v); }
+		void set(const GLchar* name, const glm::mat4& matrix) { set(uniform(name), matrix); }
 
 		void use();
+	private:
+		void reflect_uniforms_();
+	};
+
+	struct RenderStats
+	{
+		int draw_calls = 0;
+		int state_changes = 0;
+
+		void reset() { draw_calls = 0; state_changes = 0; }
+
+		RenderStats& operator+=(const RenderStats& rhs) {
+			draw_calls += rhs.draw_calls;
+			state_changes += rhs.state_changes;
+			return *this;
+		}
+	};
+
+	// Per-instance data of the sprite shader (locations 1-4 in res/sprite.vs.glsl).
+	struct SpriteInstance
+	{
+		glm::vec4 rect;  // x, y, width, height
+		glm::vec4 uv;    // left, top, right, bottom
+		glm::vec4 color;
+		float slice;     // layer of a Texture2DArray, unused for a Texture2D
+	};
+
+	// CPU side of the batched sprite path. Sprites are collected during a frame,
+	// radix sorted by a 64-bit key (layer, depth, order, texture) and split into
+	// groups of the same texture that are each drawn with a single instanced
+	// draw call. Needs no GL context, so the cost of a frame can be checked
+	// headless through cost().
+	class SpriteBatch
+	{
+	public:
+		struct Group
+		{
+			GLuint texture;
+			GLenum target;
+			std::size_t first;
+			std::size_t count;
+		};
+
+		std::vector<SpriteInstance> instances;
+		std::vector<Group> groups;
+
+		// Capacity survives clear(), once reserved (or warmed up by a frame)
+		// the same number of sprites is queued and sorted without allocating.
+		void clear();
+		void reserve(std::size_t sprites);
+
+		// Lower layers are drawn first, within a layer lower depth first, at
+		// the same depth lower order first (e.g. the map layer), then grouped
+		// by texture. Depth is kept to half a pixel. `target` is
+		// GL_TEXTURE_2D_ARRAY for the layers of a Texture2DArray.
+		void push(GLuint texture, const SpriteInstance& instance, std::uint8_t layer = 0, float depth = 0,
+		          GLenum target = GL_TEXTURE_2D, std::uint8_t order = 0);
+
+		//  63     56 55          32 31     24 23          0
+		// | layer   | depth + 2^23 | order   | texture     |
+		// Only the low 24 bits of the texture name take part, they group
+		// sprites and never decide which one is drawn on top.
+		static std::uint64_t sort_key(std::uint8_t layer, float depth, std::uint8_t order, GLuint texture);
+
+		// Orders the queued sprites by key (stable for equal keys) and fills
+		// `instances` and `groups`.
+		void sort();
+
+		// Draw calls and state changes needed to submit the sorted batch.
+		RenderStats cost() const;
+
+		bool empty() const { return queued_.empty(); }
+		std::size_t size() const { return queued_.size(); }
+	private:
+		struct Queued
+		{
+			GLuint texture;
+			GLenum target;
+			SpriteInstance instance;
+		};
+
+		// only the 16-byte keys are moved around by the sort
+		struct Key
+		{
+			std::uint64_t key;
+			std::uint32_t index;
+		};
+
+		std::vector<Queued> queued_;
+		std::vector<Key> keys_;
+		std::vector<Key> scratch_;
 	};
 
 	class SpriteRenderer
 	{
 	public:
+		RenderStats stats;
+
 		explicit SpriteRenderer(Shader& shader);
 
 		SpriteRenderer(const SpriteRenderer& other) = delete;
@@ -155,12 +522,65 @@ namespace gl
 
 		~SpriteRenderer() = default;
 
+		// Between begin() and end() draw_sprite only queues the sprite, end()
+		// then submits the whole frame sorted (see SpriteBatch), one instanced
+		// draw per run of the same texture. Outside of begin()/end() every
+		// sprite is drawn immediately.
+		void begin();
+		void end();
+		bool queuing() const { return batching; }
+
+		// Layer of the sprites queued from now on. On a y-sorted layer sprites
+		// are ordered by their bottom edge, so characters walking behind a
+		// tree are covered by it and in front of it cover it. Sprites with the
+		// same bottom edge are drawn by `order`, lowest first.
+		void set_layer(std::uint8_t layer, bool y_sorted = false, std::uint8_t order = 0) {
+			this->layer = layer;
+			this->y_sorted = y_sorted;
+			this->order = order;
+		}
+
 		void draw_sprite(Texture2D& texture, glm::vec2 pos, glm::vec2 size = glm::vec2(32, 32), glm::vec3 color = glm::vec3(1.0f));
+
+		// Draws the uv sub-rectangle (left, top, right, bottom) of the texture,
+		// used for atlas pages.
+		void draw_sprite(Texture2D& texture, const glm::vec4& uv, glm::vec2 pos, glm::vec2 size = glm::vec2(32, 32), glm::vec3 color = glm::vec3(1.0f));
+
+		// Draws one layer of the array, e.g. a tile of TextureAtlas::tiles.
+		// Sprites of every layer batch into one draw.
+		void draw_sprite(Texture2DArray& texture, int slice, glm::vec2 pos, glm::vec2 size = glm::vec2(32, 32), glm::vec3 color = glm::vec3(1.0f));
+
+		// Draws a sorted batch whose instances were uploaded to `buffer` ahead
+		// of time, for geometry that does not change between frames.
+		void draw_batch(const SpriteBatch& batch, const VBO& buffer);
+
+		// While set, draw_sprite drops sprites outside of the rectangle
+		// (left, top, right, bottom), see Camera::visible_rect.
+		void set_cull_rect(const glm::vec4& rect) { cull_rect = rect; culling = true; }
+		void disable_culling() { culling = false; }
 	private:
 		Shader& shader;
+		Uniform array_;
+		bool array_bound_ = false;
 
 		VAO vao;
 		VBO vbo;
+		StreamBuffer instances;
+
+		SpriteBatch batch;
+		bool batching = false;
+
+		std::uint8_t layer = 0;
+		bool y_sorted = false;
+		std::uint8_t order = 0;
+
+		glm::vec4 cull_rect;
+		bool culling = false;
+
+		void flush();
+		void queue_(GLuint texture, GLenum target, const SpriteInstance& instance);
+		// Expects the instance buffer bound, `offset` is where the batch starts.
+		void submit_(const SpriteBatch& batch, GLintptr offset);
 	};
 
 	struct ColorTex
@@ -187,6 +607,7 @@ namespace gl
 			  useTexture(useTexture) {}
 	};
 
+	// 40 bytes, everything as floats. Drawn with res/batch.
 	class Vertex
 	{
 	public:
@@ -195,6 +616,9 @@ namespace gl
 		glm::vec2 texCoord;
 		GLfloat useTexture;
 
+		// uninitialized, for BasicBatch::write_quads
+		Vertex() = default;
+
 		Vertex(glm::vec3 position):
 			Vertex(std::move(position), {1,1,1,1}, {0,0}, false) {}
 
@@ -207,6 +631,8 @@ namespace gl
 			texCoord{std::move(tex_coord)},
 			useTexture(useTexture) {}
 
+		static const char* shader_name() { return "res/batch"; }
+
 		static void setup_attributes() {
 			GLsizei stride = sizeof(gl::Vertex);
 			glVertexAttribPointer(0, sizeof(position) / sizeof(float), GL_FLOAT, GL_FALSE, stride, (GLvoid*)offsetof(Vertex, position));
@@ -220,21 +646,99 @@ namespace gl
 		}
 	};
 
-	class Batch
+	// 20 bytes: RGBA8 color and 16-bit texture coordinates with the
+	// useTexture flag in the top bit of u, which leaves 15 bits for u.
+	// Coordinates are clamped to [0, 1], so no repeating textures.
+	// Drawn with res/batch_packed.
+	class PackedVertex
+	{
+	public:
+		glm::vec3 position;
+		GLuint color;
+		GLushort u;
+		GLushort v;
+
+		static const GLushort texture_bit = 0x8000;
+
+		// uninitialized, for BasicBatch::write_quads
+		PackedVertex() = default;
+
+		PackedVertex(glm::vec3 position):
+			PackedVertex(std::move(position), {1,1,1,1}, {0,0}, false) {}
+
+		PackedVertex(glm::vec3 position, ColorTex ct) :
+			PackedVertex(std::move(position), ct.color, ct.tex, ct.useTexture) {}
+
+		PackedVertex(glm::vec3 position, glm::vec4 color, glm::vec2 tex_coord, GLfloat useTexture);
+
+		static const char* shader_name() { return "res/batch_packed"; }
+
+		static void setup_attributes() {
+			GLsizei stride = sizeof(gl::PackedVertex);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (GLvoid*)offsetof(PackedVertex, position));
+			glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, stride, (GLvoid*)offsetof(PackedVertex, color));
+			glVertexAttribIPointer(2, 2, GL_UNSIGNED_SHORT, stride, (GLvoid*)offsetof(PackedVertex, u));
+			glEnableVertexAttribArray(0);
+			glEnableVertexAttribArray(1);
+			glEnableVertexAttribArray(2);
+			glDisableVertexAttribArray(3);
+		}
+	};
+
+	// Triangles of `V` (Vertex or PackedVertex), draw them with the shader
+	// V::shader_name() and a VAO set up by V::setup_attributes().
+	template <typename V>
+	class BasicBatch
 	{
 	public:
 		using v2 = glm::vec2;
 		using v3 = glm::vec3;
 		using v4 = glm::vec4;
 
-		std::vector<Vertex> vertices;
+		using vertex_type = V;
 
+		// triangle list, drawn with glDrawArrays
+		std::vector<V> vertices;
+		// 4 corners per quad, drawn with the shared quad_indices()
+		std::vector<V> quad_vertices;
+
+		// Keeps the capacity, a batch refilled every frame stops allocating
+		// once it has seen its largest frame (or after reserve()).
 		void clear();
-		void push_back(Vertex v);
-		void draw_arrays();
+		void reserve(std::size_t triangle_vertices, std::size_t quads);
+
+		void push_back(const V& v) {
+			begin_run_(false, vertices.size());
+			vertices.push_back(v);
+		}
+
+		template <typename... Args>
+		void emplace_back(Args&&... args) {
+			begin_run_(false, vertices.size());
+			vertices.emplace_back(std::forward<Args>(args)...);
+		}
+
+		// Appends `count` quads and returns their 4 * count corners to be
+		// written in place, valid until the next push.
+		V* write_quads(std::size_t count);
+
+		// Appends the vertices to the stream and draws them ordered by z,
+		// triangles and quads with the same z in the order they were pushed,
+		// one draw per run of triangles or quads in that order (a batch that
+		// does not mix them at one z takes at most two). The bound VAO must
+		// have its attributes set up with the stream buffer bound at offset
+		// 0. Returns the draw calls.
+		int draw(StreamBuffer& stream);
+
+		// Radix sort the triangles (by the z of their first vertex) and the
+		// quads by the z they were pushed with, lower z first (drawn below),
+		// the same z keeps the push order.
+		void sort_triangles();
+		void sort_quads();
 
 		// TODO - cleanup these overloads
 		void push_triangle(v2 p1, v2 p2, v2 p3, float z, ColorTex ct);
+		// corners in order around the quad
 		void push_quad(v2 p1, v2 p2, v2 p3, v2 p4, float z, ColorTex ct);
 
 		void push_quad(v2 center, float width, float height, float z, ColorTex ct);
@@ -243,7 +747,41 @@ namespace gl
 		void push_hex(v2 position, v3 color, float r);
 		void push_hex(v2 position, v4 color, float r);
 		void push_hex(v3 position, v4 color, float r);
+	private:
+		struct Key
+		{
+			std::uint64_t key;
+			std::uint32_t index;
+		};
+
+		// Primitives pushed one after another without switching between
+		// triangles and quads, `first` is the vertex of its list it starts at.
+		// The run index breaks ties of z between the two lists.
+		struct Run
+		{
+			bool quads;
+			std::size_t first;
+		};
+
+		std::vector<Run> runs_;
+		// of the sorted triangles and quads, (z, run)
+		std::vector<Key> triangle_keys_;
+		std::vector<Key> quad_keys_;
+		std::vector<Key> key_scratch_;
+		// swapped with the list they sort, one each so the capacities stay
+		std::vector<V> sorted_;
+		std::vector<V> sorted_triangles_;
+
+		void begin_run_(bool quads, std::size_t first) {
+			if (runs_.empty() || runs_.back().quads != quads) runs_.push_back({ quads, first });
+		}
+
+		// `list` holds primitives of `corners` vertices
+		void sort_by_z_(std::vector<V>& list, std::vector<V>& sorted, std::vector<Key>& keys, bool quads);
 	};
+
+	using Batch = BasicBatch<Vertex>;
+	using PackedBatch = BasicBatch<PackedVertex>;
 }
 
 #endif
@@ -269,6 +269,10 @@ struct LodePNGDecompressSettings
                              const LodePNGDecompressSettings*);
 
   const void* custom_context; /*optional custom settings for custom functions*/
+
+  /*decode Huffman codes with lookup tables (default: 1). 0 walks the code tree
+  bit by bit like the original decoder, kept to compare against*/
+  unsigned fast_inflate;
 };
 
 extern const LodePNGDecompressSettings lodepng_default_decompress_settings;
@@ -524,6 +528,10 @@ typedef struct LodePNGDecoderSettings
 
   unsigned color_convert; /*whether to convert the PNG to the color type you want. Default: yes*/
 
+  /*unfilter 3 and 4 byte pixels with SSE2 where available (default: 1). 0 uses
+  the original scalar code, the output is the same*/
+  unsigned fast_unfilter;
+
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   unsigned read_text_chunks; /*if false but remember_unknown_chunks is true, they're stored in the unknown chunks*/
   /*store all bytes from unknown chunks in the LodePNGInfo (off by default, useful for a png editor)*/
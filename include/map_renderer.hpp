@@ -0,0 +1,96 @@
+#ifndef MAP_RENDERER_HPP__
+#define MAP_RENDERER_HPP__
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <gl_utils.hpp>
+#include <atlas.hpp>
+#include <tiled.hpp>
+
+namespace gl
+{
+	// Draws a TileMap chunk by chunk. Every chunk keeps its sprite instances
+	// in its own buffer and only rebuilds them when TileLayer::set_gid()
+	// changed one of its cells, so terrain is not re-sent to the GPU every
+	// frame. A frame costs one instanced draw per chunk and atlas page.
+	class MapRenderer
+	{
+	public:
+		MapRenderer(SpriteRenderer& sprites, TileMap& map, TextureAtlas& atlas);
+
+		MapRenderer(const MapRenderer& other) = delete;
+		MapRenderer(MapRenderer&& other) = delete;
+		MapRenderer& operator=(const MapRenderer& other) = delete;
+		MapRenderer& operator=(MapRenderer&& other) = delete;
+
+		void draw();
+		// Only draws (and rebuilds) the chunks overlapping the rectangle
+		// (left, top, right, bottom), see Camera::visible_rect.
+		void draw(const glm::vec4& view);
+
+		// A y-sorted layer skips the static chunks, its cells are queued into
+		// the sprite renderer on `sort_layer` every frame instead, so they
+		// sort against characters drawn on the same layer. Needs draw() to be
+		// called between SpriteRenderer::begin() and end(). Cells with the
+		// same bottom edge are drawn in map order, the map layer index is
+		// their SpriteRenderer order.
+		//
+		// Layers are drawn in map order. A static layer above y-sorted ones
+		// first submits everything queued into the sprite renderer so far
+		// (an extra end()/begin()), so it covers those cells and the sprites
+		// queued before draw(). Sprites queued after draw() sort against the
+		// y-sorted layers above the last static one only, keep the y-sorted
+		// layers on top of the map to sort characters against all of them.
+		void set_y_sorted(std::size_t layer, bool y_sorted = true);
+		// A hidden layer is not drawn at all, e.g. while TilemapRenderer
+		// draws it.
+		void set_hidden(std::size_t layer, bool hidden = true);
+		std::uint8_t sort_layer = 1;
+		// Order of sprites on `sort_layer` that draw over the cells of every
+		// map layer in their row, e.g. the player.
+		std::uint8_t sprite_order() const;
+
+		// Chunks drawn and rebuilt during the last draw().
+		int drawn = 0;
+		int rebuilt = 0;
+
+		// Called with the tile id (gid - 1) of every cell drawn without an
+		// atlas region, the atlas must not change until draw() returns.
+		// Chunks missing a tile are rebuilt once the atlas revision changes.
+		std::function<void(int id)> on_missing;
+	private:
+		struct Chunk
+		{
+			std::size_t layer;
+			int x, y;
+			unsigned revision = ~0u;
+			// atlas revision of the last build when a tile was missing
+			bool incomplete = false;
+			unsigned atlas_revision = 0;
+			// the tile array the batch draws from, a new one once it grew
+			GLuint tiles_id = 0;
+
+			SpriteBatch batch;
+			VBO instances;
+		};
+
+		SpriteRenderer& sprites;
+		TileMap& map;
+		TextureAtlas& atlas;
+
+		// every layer's chunks row by row, layer_chunks_[l] is the first of l
+		std::vector<std::unique_ptr<Chunk>> chunks_;
+		std::vector<std::size_t> layer_chunks_;
+		std::vector<bool> y_sorted_;
+		std::vector<bool> hidden_;
+
+		void build_(Chunk& chunk);
+		void draw_(Chunk& chunk);
+		void queue_(std::size_t layer, const CellRange& range);
+		void flush_();
+	};
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file mapped into memory. With `writable` the
+// mapping is private (copy-on-write), writes never reach the file.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& filename, bool writable = false);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	MappedFile(MappedFile&& rhs);
+	MappedFile& operator=(MappedFile&& rhs);
+
+	bool open(const std::string& filename, bool writable = false);
+	void close();
+
+	bool is_open() const { return data_ != nullptr; }
+
+	unsigned char* data() const { return data_; }
+	std::size_t size() const { return size_; }
+
+private:
+	unsigned char* data_ = nullptr;
+	std::size_t size_ = 0;
+#ifdef _WIN32
+	void* file_ = nullptr;
+	void* mapping_ = nullptr;
+#endif
+};
+
+// Last modification of the file in nanoseconds since the epoch (as fine as
+// the file system keeps it), -1 when there is no such file. Tells cooked
+// data from a source edited since.
+std::int64_t file_mtime(const std::string& filename);
+
+#endif /* MAPPED_FILE_HPP */
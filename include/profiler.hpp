@@ -0,0 +1,239 @@
+#ifndef PROFILER_HPP__
+#define PROFILER_HPP__
+
+// Scoped zone profiler. Build with -DKURATKO_PROFILER to enable it, without
+// it the PROFILE_* macros expand to nothing and none of this is compiled.
+//
+//   void draw() {
+//       PROFILE_GPU_ZONE("map");   // CPU zone plus GL timestamps around it
+//       ...
+//   }
+//
+//   PROFILE_FRAME();               // once per frame, after the swap
+//   PROFILE_OVERLAY();             // ImGui window with the last frame
+//
+// The last `trace_capacity` frames are kept and can be written as a Chrome
+// trace (chrome://tracing, ui.perfetto.dev) on demand, or automatically
+// when a frame goes over the spike budget:
+//
+//   PROFILE_SPIKE_BUDGET(33.3f, 120);  // dump 120 frames after a slow one
+//   PROFILE_WRITE_TRACE("trace.json", 300);
+
+#ifdef KURATKO_PROFILER
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include <stopwatch.hpp>
+
+namespace prof
+{
+	// Completed zone, times in microseconds since the profiler was created.
+	struct Zone
+	{
+		const char* name;
+		int64_t begin;
+		int64_t end;
+		int depth;
+		int thread;
+	};
+
+	// Zones finished by one thread. Only the owning thread pushes and only
+	// Profiler::frame() drains, so no lock is needed; when the reader falls
+	// behind the newest zones are dropped.
+	class ZoneRing
+	{
+	public:
+		static const uint32_t capacity = 4096;
+
+		int thread;
+		int depth = 0;
+		std::atomic<uint32_t> dropped{0};
+
+		explicit ZoneRing(int thread): thread(thread) {}
+
+		void push(const Zone& zone);
+
+		template <typename F>
+		void drain(F f) {
+			uint32_t tail = tail_.load(std::memory_order_relaxed);
+			uint32_t head = head_.load(std::memory_order_acquire);
+			for (; tail != head; tail++) {
+				f(zones_[tail & (capacity - 1)]);
+			}
+			tail_.store(tail, std::memory_order_release);
+		}
+	private:
+		Zone zones_[capacity];
+		std::atomic<uint32_t> head_{0};
+		std::atomic<uint32_t> tail_{0};
+	};
+
+	struct Frame
+	{
+		// zones kept per frame, reserved up front so recording a frame does
+		// not allocate; the rest is dropped and counted in ZoneRing::dropped
+		static const std::size_t max_zones = 256;
+
+		uint64_t index = 0;
+		int64_t begin = 0;
+		int64_t end = 0;
+		std::vector<Zone> zones;
+		// GPU zones relative to `begin`, filled in when the queries resolve
+		std::vector<Zone> gpu_zones;
+	};
+
+	class Profiler
+	{
+	public:
+		// frame times of the last `history_size` frames, oldest at history_offset
+		static const int history_size = 120;
+		float history[history_size] = {};
+		int history_offset = 0;
+
+		// frames kept for trace export
+		static const int trace_capacity = 512;
+
+		Profiler();
+
+		Profiler(const Profiler& other) = delete;
+		Profiler& operator=(const Profiler& other) = delete;
+
+		int64_t now() const { return clock_.us(); }
+
+		// Ring of the calling thread, registered on first use.
+		ZoneRing& ring();
+
+		// Ends the current frame: collects zones from all threads and resolves
+		// GPU timestamps that became available.
+		void frame();
+
+		const Frame& last_frame() const { return frames_[(current_.index - 1) % trace_capacity]; }
+		// GPU results lag a few frames behind, times are relative to the
+		// start of that frame on the GPU.
+		const Frame& last_gpu_frame() const { return last_gpu_; }
+
+		// Writes the last `frames` frames as Chrome trace events, false when
+		// the file cannot be opened.
+		bool write_trace(const std::string& filename, int frames) const;
+
+		// A frame longer than `ms` writes `frames` frames around it to
+		// spike_<frame>.json, half of them recorded after the spike so the
+		// trace shows what led to it and what followed. 0 disables it.
+		void set_spike_budget(float ms, int frames);
+
+		// GL_TIMESTAMP query pair around a GPU zone, main thread only.
+		int gpu_begin(const char* name, int depth);
+		void gpu_end(int query);
+	private:
+		struct GpuQuery
+		{
+			const char* name;
+			int depth;
+			GLuint begin;
+			GLuint end;
+		};
+
+		struct GpuFrame
+		{
+			uint64_t index = 0;
+			bool pending = false;
+			GLuint start = 0;
+			std::vector<GpuQuery> queries;
+		};
+
+		// frames whose queries may be in flight, a frame still unresolved
+		// when its slot comes round again is given up
+		static const int gpu_latency = 8;
+
+		Stopwatch clock_;
+
+		mutable std::mutex rings_mutex_;
+		std::vector<ZoneRing*> rings_;
+
+		Frame current_;
+		std::vector<Frame> frames_;
+		Frame last_gpu_;
+
+		int64_t spike_budget_ = 0;
+		int spike_frames_ = 0;
+		bool spike_pending_ = false;
+		uint64_t spike_dump_at_ = 0;
+		uint64_t spike_index_ = 0;
+
+		// slot index % gpu_latency, like ZoneRing for the CPU zones
+		GpuFrame gpu_frames_[gpu_latency];
+		// the oldest frame that may still have to be resolved
+		uint64_t gpu_resolve_next_ = 0;
+		std::vector<GLuint> free_queries_;
+
+		GLuint query_();
+		GpuFrame& start_gpu_frame_();
+		void release_gpu_frame_(GpuFrame& frame);
+		void resolve_gpu_frames_();
+	};
+
+	Profiler& profiler();
+
+	class ScopedZone
+	{
+		const char* name_;
+		int64_t begin_;
+		ZoneRing& ring_;
+	public:
+		explicit ScopedZone(const char* name);
+		~ScopedZone();
+
+		ScopedZone(const ScopedZone& other) = delete;
+		ScopedZone& operator=(const ScopedZone& other) = delete;
+
+		int depth() const { return ring_.depth - 1; }
+	};
+
+	class ScopedGpuZone
+	{
+		ScopedZone cpu_;
+		int query_;
+	public:
+		explicit ScopedGpuZone(const char* name);
+		~ScopedGpuZone();
+	};
+
+	// ImGui window with the frame time graph and a bar view of the last CPU
+	// and GPU frames (profiler_overlay.cpp).
+	void draw_overlay();
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_NAME_(a, b) PROFILE_CONCAT_(a, b)
+
+#define PROFILE_ZONE(name) prof::ScopedZone PROFILE_NAME_(profile_zone_, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) prof::ScopedGpuZone PROFILE_NAME_(profile_zone_, __LINE__)(name)
+#define PROFILE_FRAME() prof::profiler().frame()
+#define PROFILE_OVERLAY() prof::draw_overlay()
+#define PROFILE_SPIKE_BUDGET(ms, frames) prof::profiler().set_spike_budget(ms, frames)
+#define PROFILE_WRITE_TRACE(filename, frames) prof::profiler().write_trace(filename, frames)
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_GPU_ZONE(name) ((void)0)
+#define PROFILE_FRAME() ((void)0)
+#define PROFILE_OVERLAY() ((void)0)
+#define PROFILE_SPIKE_BUDGET(ms, frames) ((void)0)
+// a call, a bare `false` warns when used as a statement
+#define PROFILE_WRITE_TRACE(filename, frames) prof::no_trace()
+
+namespace prof
+{
+	inline bool no_trace() { return false; }
+}
+
+#endif
+
+#endif
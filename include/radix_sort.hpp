@@ -0,0 +1,62 @@
+#ifndef RADIX_SORT_HPP__
+#define RADIX_SORT_HPP__
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// LSD radix sort of `items` by a 64-bit key, one byte per pass. Stable, so
+// items with equal keys keep their order. Passes over bytes that are the same
+// in every key are skipped, keys that only use a few bits cost a few passes.
+// `scratch` is resized to items.size() and can be kept around so repeated
+// sorts do not allocate.
+template <typename T, typename Key>
+void radix_sort(std::vector<T>& items, std::vector<T>& scratch, Key key) {
+	const std::size_t n = items.size();
+	if (n < 2) return;
+
+	std::size_t counts[8][256];
+	std::memset(counts, 0, sizeof(counts));
+
+	for (auto&& item : items) {
+		std::uint64_t k = key(item);
+		for (int pass = 0; pass < 8; pass++) {
+			counts[pass][(k >> (pass * 8)) & 0xff]++;
+		}
+	}
+
+	// the two vectors swap buffers, give both the same capacity so the
+	// scratch one does not reallocate every time items grows by a few
+	if (scratch.capacity() < items.capacity()) scratch.reserve(items.capacity());
+	scratch.resize(n);
+
+	for (int pass = 0; pass < 8; pass++) {
+		std::size_t* count = counts[pass];
+
+		std::uint64_t first = (key(items[0]) >> (pass * 8)) & 0xff;
+		if (count[first] == n) continue;
+
+		std::size_t offset = 0;
+		for (int digit = 0; digit < 256; digit++) {
+			std::size_t c = count[digit];
+			count[digit] = offset;
+			offset += c;
+		}
+
+		for (auto&& item : items) {
+			scratch[count[(key(item) >> (pass * 8)) & 0xff]++] = item;
+		}
+
+		items.swap(scratch);
+	}
+}
+
+// Maps a float to an unsigned integer with the same order, for sort keys.
+inline std::uint32_t float_sort_bits(float value) {
+	std::uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	// negative: flip everything, positive: flip the sign bit
+	return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+#endif
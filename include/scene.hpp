@@ -0,0 +1,94 @@
+#ifndef SCENE_HPP__
+#define SCENE_HPP__
+
+#include <list>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <gl_utils.hpp>
+#include <asset_archive.hpp>
+#include <asset_manager.hpp>
+#include <atlas.hpp>
+#include <map_renderer.hpp>
+#include <texture_loader.hpp>
+#include <tilemap_renderer.hpp>
+#include <tiled.hpp>
+
+// Everything the game draws outside of ImGui. Shared by game_loop and the
+// headless benchmark (tools/headless.cpp) so both render the same frames.
+class Scene
+{
+public:
+	int width, height;
+
+	// cooked res/ (see `make cook`), used before the loose files when there
+	gl::AssetArchive archive;
+	gl::ShaderSources shader_sources;
+
+	gl::Shader sprite_shader;
+	gl::SpriteRenderer sprites;
+
+	// decodes the tiles in parallel, later textures stream in during draw()
+	gl::TextureLoader loader;
+	// sprite textures, shared by path and content
+	gl::AssetManager assets;
+
+	TileMap map;
+	// only the tiles the map uses, others are added when a cell needs them
+	gl::TextureAtlas atlas;
+	gl::MapRenderer map_renderer;
+	// draws the ground in the fragment shader instead when tilemap_shader is set
+	gl::TilemapRenderer tilemap;
+	bool tilemap_shader = false;
+
+	gl::Camera camera;
+	glm::mat4 projection;
+
+	gl::TextureHandle player;
+	int player_x = 0;
+	int player_y = 0;
+
+	// `map_name` without extension, the archive is preferred over the
+	// precompiled .kmap and that over the .tmx (see `make cook` and `make
+	// maps`) unless the .tmx changed since. With 0 decode threads every PNG is decoded on the calling
+	// thread. An empty `archive_name` loads the loose files only.
+	Scene(const std::string& map_name, int width, int height,
+	      unsigned decode_threads = gl::TextureLoader::default_threads(),
+	      const std::string& archive_name = "res.kpak");
+
+	Scene(const Scene& other) = delete;
+	Scene(Scene&& other) = delete;
+	Scene& operator=(const Scene& other) = delete;
+	Scene& operator=(Scene&& other) = delete;
+
+	// Uploads textures that finished loading, clears the frame counters,
+	// draws the map and the player and keeps the textures in budget.
+	void draw();
+
+	// World rectangle on screen, valid after draw().
+	glm::vec4 view() const { return view_; }
+
+	// Tiles first used after loading that are not in the atlas yet.
+	std::size_t tiles_loading() const { return missing_.size() + late_tiles_.size(); }
+private:
+	glm::vec4 view_;
+
+	struct LateTile
+	{
+		int id;
+		gl::DecodedImage image;
+	};
+
+	// tile ids in the atlas, being loaded or failed to load
+	std::unordered_set<int> requested_;
+	// reported by the map renderer, loaded in the next frame
+	std::vector<int> missing_;
+	// decoding, the loader writes into them in place
+	std::list<LateTile> late_tiles_;
+
+	// Adds decoded tiles to the atlas and starts loading the missing ones.
+	void load_missing_tiles_();
+};
+
+#endif
@@ -3,25 +3,32 @@
 
 #include <chrono>
 
+// steady_clock, unlike high_resolution_clock (an alias of system_clock on some
+// standard libraries), never jumps when the wall clock is adjusted.
 struct Stopwatch
 {
-	std::chrono::time_point<std::chrono::high_resolution_clock> start_;
+	std::chrono::time_point<std::chrono::steady_clock> start_;
 
 	Stopwatch() {
 		start();
 	}
 
 	void start() {
-		start_ = std::chrono::high_resolution_clock::now();
+		start_ = std::chrono::steady_clock::now();
 	}
 
 	int64_t ms() const {
-		auto end = std::chrono::high_resolution_clock::now();
+		auto end = std::chrono::steady_clock::now();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(end - start_).count();
+	}
+
+	int64_t us() const {
+		auto end = std::chrono::steady_clock::now();
 		return std::chrono::duration_cast<std::chrono::microseconds>(end - start_).count();
 	}
 
 	float ms_float() const {
-		auto end = std::chrono::high_resolution_clock::now();
+		auto end = std::chrono::steady_clock::now();
 		auto us_count = std::chrono::duration_cast<std::chrono::microseconds>(end - start_).count();
     return ((float)us_count)/1000.0f;
 	}
@@ -0,0 +1,119 @@
+#ifndef TEXTURE_LOADER_HPP__
+#define TEXTURE_LOADER_HPP__
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gl_utils.hpp>
+
+namespace gl
+{
+	// Premultiplied RGBA8 pixels of a decoded PNG, `error` is the lodepng
+	// error code.
+	struct DecodedImage
+	{
+		unsigned width = 0, height = 0;
+		// a mip chain (see build_mip_chain) when decoded for a texture
+		std::uint32_t levels = 1;
+		std::vector<unsigned char> pixels;
+		unsigned error = 0;
+	};
+
+	// Decodes PNGs on a pool of worker threads. Finished images are handed
+	// back to the GL thread in update(), which uploads textures through a
+	// pixel unpack StreamBuffer so glTexImage2D only queues a copy on the
+	// GPU instead of reading client memory. Textures get immutable storage
+	// with a mip chain built on the worker.
+	//
+	//   loader.load_png(player, "res/player.png");  // placeholder until ready
+	//   ...
+	//   loader.update();                             // every frame
+	//
+	// A texture or image passed in has to stay where it is until it is
+	// finished, call finish() before moving or destroying it.
+	class TextureLoader
+	{
+	public:
+		// bytes uploaded by one update() unless told otherwise
+		static const std::size_t frame_budget = 4 << 20;
+		// images above this are uploaded from client memory
+		static const std::size_t unpack_size = 8 << 20;
+
+		// 1x1 RGBA texel shown by textures that are not ready yet
+		unsigned char placeholder[4] = { 255, 0, 255, 255 };
+
+		// One thread less than the hardware has, the GL thread keeps busy too.
+		static unsigned default_threads();
+
+		// With 0 threads the images are decoded on the GL thread by update()
+		// and finish(), one after another.
+		explicit TextureLoader(unsigned threads = default_threads());
+		~TextureLoader();
+
+		TextureLoader(const TextureLoader& other) = delete;
+		TextureLoader(TextureLoader&& other) = delete;
+		TextureLoader& operator=(const TextureLoader& other) = delete;
+		TextureLoader& operator=(TextureLoader&& other) = delete;
+
+		// Gives the texture the placeholder and queues the PNG, the texture
+		// is ready once update() has uploaded it. GL thread only.
+		void load_png(Texture2D& texture, const std::string& filename);
+		// Same, but decodes a PNG already in memory, which has to stay there
+		// until the texture is ready. `name` is only used in error messages.
+		void load_png(Texture2D& texture, const std::string& name, const unsigned char* png, std::size_t size);
+
+		// Queues the PNG to be decoded into `image` by the time update()
+		// reports it finished, no GL involved.
+		void decode_png(const std::string& filename, DecodedImage& image);
+
+		// Uploads (or hands over) decoded images until about `budget` bytes
+		// were uploaded, returns how many loads finished. GL thread only.
+		int update(std::size_t budget = frame_budget);
+
+		// Blocks until everything queued is finished, decoding on this thread
+		// as well while waiting.
+		void finish();
+
+		// Loads queued and not yet finished.
+		std::size_t pending() const { return pending_; }
+	private:
+		struct Job
+		{
+			std::string filename;
+			Texture2D* texture;
+			DecodedImage* image;
+			DecodedImage decoded;
+			// decoded instead of the file when set
+			const unsigned char* png;
+			std::size_t png_size;
+		};
+
+		std::vector<std::thread> workers_;
+
+		std::mutex mutex_;
+		std::condition_variable queued_cv_;
+		std::condition_variable decoded_cv_;
+		std::deque<Job> queued_;
+		std::deque<Job> decoded_;
+		bool stop_ = false;
+
+		std::size_t pending_ = 0;
+		// created on the first texture upload, decoding alone needs no GL
+		std::unique_ptr<StreamBuffer> unpack_;
+
+		void queue_(Job job);
+		void work_();
+		static void decode_(Job& job);
+		// returns the bytes uploaded
+		std::size_t finish_(Job& job);
+	};
+}
+
+#endif
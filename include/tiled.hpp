@@ -1,13 +1,12 @@
 #ifndef TILED_HPP
 #define TILED_HPP
 
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/xml_parser.hpp>
-
-#include <iostream>
+#include <memory>
+#include <ostream>
 #include <vector>
 #include <string>
-#include <unordered_map>
+
+class MappedFile;
 
 
 class Tile
@@ -19,69 +18,136 @@ public:
 	std::string filename;
 };
 
-class TileMap
+// The cells of a layer. Either owns its storage or points into a mapped
+// binary map file, copies share the cells.
+class GidView
 {
 public:
-	std::vector<Tile> tiles;
-	std::vector<int> map;
-	std::unordered_map<int, Tile> guids;
+	GidView() = default;
+	GidView(int* data, std::size_t size, std::shared_ptr<void> owner):
+		data_(data), size_(size), owner_(std::move(owner)) {}
+
+	// Zero-filled, owned storage.
+	static GidView allocate(std::size_t size);
+
+	int* data() const { return data_; }
+	std::size_t size() const { return size_; }
+	bool empty() const { return size_ == 0; }
+
+	int* begin() const { return data_; }
+	int* end() const { return data_ + size_; }
 
-	std::size_t N() {
-		// !!! MAPA MUSI BYT CTVERCOVA !!!
-		int N = sqrt(map.size());
-		assert(N*N == map.size());
+	int& operator[](std::size_t i) const { return data_[i]; }
 
-		return N;
+private:
+	int* data_ = nullptr;
+	std::size_t size_ = 0;
+	std::shared_ptr<void> owner_;
+};
+
+// The layer is split into chunk_size x chunk_size chunks for rendering.
+// Every write through set_gid() bumps the revision of its chunk, so cached
+// chunk geometry only has to be rebuilt when the revision changed.
+class TileLayer
+{
+public:
+	static const int chunk_size = 32;
+
+	std::string name;
+	int width = 0;
+	int height = 0;
+	GidView gids;
+
+	// row i, column j
+	int gid(std::size_t i, std::size_t j) const {
+		return gids[i * width + j];
 	}
 
-	int& gid(std::size_t i, std::size_t j) {		
-		return map[i * N() + j];
+	void set_gid(std::size_t i, std::size_t j, int gid);
+
+	int chunks_x() const { return (width + chunk_size - 1) / chunk_size; }
+	int chunks_y() const { return (height + chunk_size - 1) / chunk_size; }
+
+	unsigned revision(int chunk_x, int chunk_y) const {
+		return revisions_.empty() ? 0 : revisions_[chunk_y * chunks_x() + chunk_x];
 	}
+
+private:
+	std::vector<unsigned> revisions_;
 };
 
-TileMap load_tiles(const std::string& filename) {
-	namespace pt = boost::property_tree;
+// Half-open range of rows and columns.
+struct CellRange
+{
+	int row_begin = 0, row_end = 0;
+	int col_begin = 0, col_end = 0;
 
-	pt::ptree tree;
-	pt::read_xml(filename, tree);
-	std::unordered_map<int, Tile> guids;
+	bool empty() const { return row_begin >= row_end || col_begin >= col_end; }
+};
 
+class TileMap
+{
+public:
+	// sorted by gid
 	std::vector<Tile> tiles;
+	// in drawing order, bottom first
+	std::vector<TileLayer> layers;
 
-	for (auto& x: tree.get_child("map.tileset")) {
-		if (x.first == "tile") {
-			auto& tile = x.second;
-			int gid = tile.get<int>("<xmlattr>.id");
+	int width = 0;
+	int height = 0;
+	int tile_width = 0;
+	int tile_height = 0;
 
-			auto& image = tile.get_child("image");
-			int width = image.get<int>("<xmlattr>.width");
-			int height = image.get<int>("<xmlattr>.height");
-			std::string source = image.get<std::string>("<xmlattr>.source");
+	const Tile* find_tile(int gid) const;
 
-			tiles.push_back({
-				gid,
-				width,
-				height,
-				source
-			});
+	int gid(std::size_t layer, std::size_t i, std::size_t j) const {
+		return layers[layer].gid(i, j);
+	}
 
-			guids[gid] = tiles.back();
+	// first layer
+	int gid(std::size_t i, std::size_t j) const {
+		return layers[0].gid(i, j);
+	}
 
-		}
+	void set_gid(std::size_t layer, std::size_t i, std::size_t j, int gid) {
+		layers[layer].set_gid(i, j, gid);
 	}
 
-	std::vector<int> map;
+	// Cells of the layer overlapping a rectangle in pixels, clamped to the
+	// layer, so that only what is on screen gets visited.
+	CellRange cells_in(std::size_t layer, float left, float top, float right, float bottom) const;
+	// The same for the chunks of the layer, rows are chunk_y and columns
+	// chunk_x.
+	CellRange chunks_in(std::size_t layer, float left, float top, float right, float bottom) const;
+
+	// f(i, j, gid) for every cell of the range
+	template <typename F>
+	void for_each_cell(std::size_t layer, const CellRange& range, F f) const {
+		const TileLayer& l = layers[layer];
 
+		for (int i = range.row_begin; i < range.row_end; i++) {
+			const int* row = l.gids.data() + (std::size_t)i * l.width;
 
-	for (auto& tile : tree.get_child("map.layer.data")) {
-		if (tile.first == "tile") {
-			map.push_back(tile.second.get<int>("<xmlattr>.gid"));
+			for (int j = range.col_begin; j < range.col_end; j++) {
+				f(i, j, row[j]);
+			}
 		}
 	}
+};
 
-	return {tiles, map, guids};
-}
+// Reads a Tiled .tmx map. The layer data may be stored as <tile> elements,
+// csv or base64 (uncompressed, zlib or gzip).
+TileMap load_tiles(const std::string& filename);
 
+// Precompiled binary map (.kmap, see tools/tmx2kmap.cpp). The file is
+// mapped copy-on-write and the layer cells point straight into it.
+TileMap load_binary_map(const std::string& filename);
+// A .kmap stored at `offset` in a mapped file (an asset archive), which has
+// to be mapped copy-on-write, throws when offset and size leave the file.
+// `name` is only used in error messages.
+TileMap load_binary_map(std::shared_ptr<MappedFile> file, std::size_t offset, std::size_t size, const std::string& name);
+void save_binary_map(const TileMap& map, const std::string& filename);
+void save_binary_map(const TileMap& map, std::ostream& out);
 
-#endif /* TILED_HPP */
 
+#endif /* TILED_HPP */
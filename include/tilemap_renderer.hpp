@@ -0,0 +1,79 @@
+#ifndef TILEMAP_RENDERER_HPP__
+#define TILEMAP_RENDERER_HPP__
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <gl_utils.hpp>
+#include <atlas.hpp>
+#include <tiled.hpp>
+
+namespace gl
+{
+	// Draws whole layers of a TileMap without any per-cell geometry. Every
+	// layer is kept on the GPU as an integer texture of its gids and the atlas
+	// regions as a table indexed by tile id; the fragment shader
+	// (res/tilemap) looks up the cell under each pixel and samples its tile.
+	// A layer costs one quad per atlas page it uses (the tile array counts as
+	// one), whatever the size of the map.
+	// Draws the same pixels as MapRenderer.
+	class TilemapRenderer
+	{
+	public:
+		RenderStats stats;
+
+		// See MapRenderer::on_missing, cells are checked when their chunk is
+		// uploaded.
+		std::function<void(int id)> on_missing;
+
+		TilemapRenderer(TileMap& map, TextureAtlas& atlas);
+
+		TilemapRenderer(const TilemapRenderer& other) = delete;
+		TilemapRenderer(TilemapRenderer&& other) = delete;
+		TilemapRenderer& operator=(const TilemapRenderer& other) = delete;
+		TilemapRenderer& operator=(TilemapRenderer&& other) = delete;
+
+		// Draws the part of the layer inside `view` (left, top, right,
+		// bottom), uploading the chunks in view that TileLayer::set_gid()
+		// changed first.
+		void draw(std::size_t layer, const glm::mat4& projection, const glm::vec4& view);
+
+		// The viewport (x, y, width, height) given to glViewport, which the
+		// shader needs to snap cell edges to pixels like the rasterizer. Kept
+		// here as reading GL_VIEWPORT back every frame stalls the pipeline.
+		// The one current at construction until then.
+		void set_viewport(const glm::vec4& viewport);
+	private:
+		struct Layer
+		{
+			Texture2D gids;
+			// TileLayer::revision() of every chunk when it was uploaded
+			std::vector<unsigned> revisions;
+			// bit n: a cell of the chunk is on atlas page n, the last bit
+			// stands for that page and all after it
+			std::vector<std::uint32_t> pages;
+			bool uploaded = false;
+		};
+
+		TileMap& map;
+		TextureAtlas& atlas;
+
+		Shader shader;
+		Uniform projection_, rect_, page_, tile_size_, viewport_;
+		VAO vao;
+
+		Texture2D regions_;
+		bool regions_built_ = false;
+		unsigned regions_revision_ = 0;
+
+		std::vector<Layer> layers_;
+
+		void upload_(std::size_t layer);
+		void upload_chunk_(std::size_t layer, int chunk_x, int chunk_y);
+		void update_pages_(std::size_t layer, int chunk_x, int chunk_y);
+		void build_regions_();
+	};
+}
+
+#endif
@@ -0,0 +1,14 @@
+#version 330 core
+
+in vec4 Color;
+in vec2 TexCoord;
+in float UseTexture;
+out vec4 color;
+
+uniform sampler2D image;
+
+void main() {
+	// premultiplied like the textures
+	vec4 tint = vec4(Color.rgb * Color.a, Color.a);
+	color = UseTexture > 0.5 ? tint * texture(image, TexCoord) : tint;
+}
@@ -0,0 +1,18 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec4 color;
+layout (location = 2) in vec2 texCoord;
+layout (location = 3) in float useTexture;
+
+out vec4 Color;
+out vec2 TexCoord;
+out float UseTexture;
+
+uniform mat4 projection;
+
+void main() {
+	Color = color;
+	TexCoord = texCoord;
+	UseTexture = useTexture;
+	gl_Position = projection * vec4(position, 1.0);
+}
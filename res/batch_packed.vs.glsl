@@ -0,0 +1,19 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+// RGBA8, normalized by the attribute setup
+layout (location = 1) in vec4 color;
+// 15-bit u with the texture flag in bit 15, 16-bit v
+layout (location = 2) in uvec2 texCoord;
+
+out vec4 Color;
+out vec2 TexCoord;
+out float UseTexture;
+
+uniform mat4 projection;
+
+void main() {
+	Color = color;
+	TexCoord = vec2(texCoord.x & 0x7fffu, texCoord.y) / vec2(32767.0, 65535.0);
+	UseTexture = float(texCoord.x >> 15u);
+	gl_Position = projection * vec4(position, 1.0);
+}
@@ -5,5 +5,6 @@ in vec4 Color;
 out vec4 color;
 
 void main() {
-	color = Color;
+	// premultiplied, blended with GL_ONE
+	color = vec4(Color.rgb * Color.a, Color.a);
 }
\ No newline at end of file
@@ -1,12 +1,19 @@
 #version 330 core
 
 in vec2 TexCoords;
+in vec4 SpriteColor;
+flat in float Slice;
 out vec4 color;
 
 uniform sampler2D image;
-uniform vec3 spriteColor;
+// set for a batch of Texture2DArray sprites, they sample layer Slice of tiles
+uniform bool array;
+uniform sampler2DArray tiles;
 
 void main() {
-	 color = vec4(spriteColor, 1.0) * texture(image, TexCoords);
+	// textures are premultiplied, so is the tint to blend with GL_ONE
+	vec4 tint = vec4(SpriteColor.rgb * SpriteColor.a, SpriteColor.a);
+	if (array) color = tint * texture(tiles, vec3(TexCoords, Slice));
+	else color = tint * texture(image, TexCoords);
 	//color = vec4(1, 0, 0, 1);
 }
\ No newline at end of file
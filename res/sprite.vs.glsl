@@ -1,12 +1,21 @@
 #version 330 core
 layout (location = 0) in vec4 vertex;
 
+// per instance
+layout (location = 1) in vec4 rect;
+layout (location = 2) in vec4 uv;
+layout (location = 3) in vec4 color;
+layout (location = 4) in float slice;
+
 out vec2 TexCoords;
+out vec4 SpriteColor;
+flat out float Slice;
 
-uniform mat4 model;
 uniform mat4 projection;
 
 void main() {
-	TexCoords = vertex.zw;
-  gl_Position = projection * model * vec4(vertex.xy, 0.0, 1.0);
+	TexCoords = mix(uv.xy, uv.zw, vertex.zw);
+	SpriteColor = color;
+	Slice = slice;
+  gl_Position = projection * vec4(rect.xy + vertex.xy * rect.zw, 0.0, 1.0);
 }
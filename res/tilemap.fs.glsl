@@ -0,0 +1,60 @@
+#version 330 core
+
+in vec2 World;
+out vec4 color;
+
+// gid of every cell, 0 is empty
+uniform isampler2D gids;
+// row 0: uv (left, top, right, bottom) of every tile id,
+// row 1: atlas page in x (-1 for the tile array, -2 for tiles without a
+// region), the layer of the array in y
+uniform sampler2D regions;
+uniform sampler2D image;
+uniform sampler2DArray tiles;
+
+// drawn from image, or from tiles when -1
+uniform int page;
+uniform vec2 tile_size;
+
+uniform mat4 projection;
+// x, y, width, height
+uniform vec4 viewport;
+// 2^GL_SUBPIXEL_BITS
+uniform float subpixel;
+
+// Window position of a world point, as the rasterizer sees a vertex there.
+vec2 window(vec2 world, bool snapped) {
+	vec4 clip = projection * vec4(world, 0.0, 1.0);
+	vec2 position = clip.xy / clip.w * (viewport.zw * 0.5) + (viewport.xy + viewport.zw * 0.5);
+	return snapped ? roundEven(position * subpixel) / subpixel : position;
+}
+
+void main() {
+	// The cell the sprite path would have drawn here: its quad covers the
+	// pixel center when it lies between the snapped edges, the lower one
+	// included. World is only close, pixels on an edge go either way.
+	vec2 cell = floor(World / tile_size);
+
+	vec2 lo = window(cell * tile_size, true);
+	vec2 hi = window((cell + 1.0) * tile_size, true);
+	vec2 direction = sign(hi - lo);
+	cell -= direction * vec2(lessThan(gl_FragCoord.xy, min(lo, hi)));
+	cell += direction * vec2(greaterThanEqual(gl_FragCoord.xy, max(lo, hi)));
+
+	bool outside = any(lessThan(cell, vec2(0))) || any(greaterThanEqual(cell, vec2(textureSize(gids, 0))));
+	int gid = outside ? 0 : texelFetch(gids, ivec2(cell), 0).r;
+	int id = gid - 1;
+	vec4 location = id < 0 || id >= textureSize(regions, 0).x ? vec4(-2) : texelFetch(regions, ivec2(id, 1), 0);
+	if (int(location.x) != page) discard;
+
+	// interpolated across the cell like the sprite's texture coordinates,
+	// the gradients are given as the implicit ones are undefined after a
+	// discard
+	lo = window(cell * tile_size, false);
+	hi = window((cell + 1.0) * tile_size, false);
+	vec4 uv = texelFetch(regions, ivec2(id, 0), 0);
+	vec2 gradient = (uv.zw - uv.xy) / (hi - lo);
+	vec2 st = mix(uv.xy, uv.zw, (gl_FragCoord.xy - lo) / (hi - lo));
+	if (page < 0) color = textureGrad(tiles, vec3(st, location.y), vec2(gradient.x, 0), vec2(0, gradient.y));
+	else color = textureGrad(image, st, vec2(gradient.x, 0), vec2(0, gradient.y));
+}
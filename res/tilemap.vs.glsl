@@ -0,0 +1,14 @@
+#version 330 core
+
+// the drawn part of the layer (left, top, right, bottom) in world space,
+// a triangle strip of 4 vertices without any vertex buffer
+uniform vec4 rect;
+uniform mat4 projection;
+
+out vec2 World;
+
+void main() {
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	World = mix(rect.xy, rect.zw, corner);
+	gl_Position = projection * vec4(World, 0.0, 1.0);
+}
@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include <asset_archive.hpp>
+#include <binary_io.hpp>
+#include <profiler.hpp>
+
+namespace gl
+{
+	namespace
+	{
+		// Layout of a .kpak file, all integers little-endian:
+		//
+		//   ArchiveHeader
+		//   ArchiveEntry[entry_count]
+		//   entry names, then the names of their sources
+		//   data of every entry, 16 byte aligned, shared by identical entries
+		const char archive_magic[4] = { 'K', 'P', 'A', 'K' };
+		// 2: textures are premultiplied
+		// 3: entries record their source file and its mtime
+		const uint32_t archive_version = 3;
+		const uint64_t data_alignment = 16;
+
+		struct ArchiveHeader
+		{
+			char magic[4];
+			uint32_t version;
+			uint32_t entry_count;
+			uint32_t reserved;
+		};
+
+		struct ArchiveEntry
+		{
+			uint64_t data_offset, data_size;
+			uint32_t name_offset, name_length;
+			uint32_t type;
+			uint32_t width, height, levels;
+			uint32_t source_offset, source_length;
+			// nanoseconds, see file_mtime()
+			int64_t source_mtime;
+		};
+
+		uint64_t align(uint64_t offset) {
+			return (offset + data_alignment - 1) / data_alignment * data_alignment;
+		}
+
+		void invalid_archive(const std::string& filename, const char* reason) {
+			std::cerr << "ERROR: " << filename << " is not a valid asset archive: " << reason << std::endl;
+			throw "Invalid asset archive";
+		}
+	}
+
+	AssetArchive::AssetArchive(const std::string& filename) {
+		open(filename);
+	}
+
+	bool AssetArchive::open(const std::string& filename) {
+		PROFILE_ZONE("open asset archive");
+
+		file_.reset();
+		entries_.clear();
+
+		// copy-on-write, cooked maps are edited in place like a .kmap
+		auto file = std::make_shared<MappedFile>();
+		if (!file->open(filename, true)) return false;
+
+		const unsigned char* base = file->data();
+		std::size_t size = file->size();
+
+		if (size < sizeof(ArchiveHeader)) invalid_archive(filename, "truncated header");
+
+		ArchiveHeader header;
+		memcpy(&header, base, sizeof(header));
+		fix_endian(header.version);
+		fix_endian(header.entry_count);
+
+		if (memcmp(header.magic, archive_magic, sizeof(archive_magic)) != 0) invalid_archive(filename, "bad magic");
+		if (header.version != archive_version) invalid_archive(filename, "unsupported version");
+		if (sizeof(ArchiveHeader) + (std::size_t)header.entry_count * sizeof(ArchiveEntry) > size) {
+			invalid_archive(filename, "truncated index");
+		}
+
+		entries_.reserve(header.entry_count);
+
+		for (uint32_t i = 0; i < header.entry_count; i++) {
+			ArchiveEntry entry;
+			memcpy(&entry, base + sizeof(ArchiveHeader) + i * sizeof(ArchiveEntry), sizeof(entry));
+			fix_endian(entry.data_offset);
+			fix_endian(entry.data_size);
+			fix_endian(entry.name_offset);
+			fix_endian(entry.name_length);
+			fix_endian(entry.type);
+			fix_endian(entry.width);
+			fix_endian(entry.height);
+			fix_endian(entry.levels);
+			fix_endian(entry.source_offset);
+			fix_endian(entry.source_length);
+			fix_endian(entry.source_mtime);
+
+			if ((std::size_t)entry.name_offset + entry.name_length > size) invalid_archive(filename, "name out of bounds");
+			if ((std::size_t)entry.source_offset + entry.source_length > size) invalid_archive(filename, "source out of bounds");
+			if (entry.data_offset > size || entry.data_size > size - entry.data_offset) {
+				invalid_archive(filename, "data out of bounds");
+			}
+
+			Entry e;
+			e.type = (Type)entry.type;
+			e.width = entry.width;
+			e.height = entry.height;
+			e.levels = entry.levels;
+			e.offset = (std::size_t)entry.data_offset;
+			e.size = (std::size_t)entry.data_size;
+			e.data = base + e.offset;
+
+			if (e.type == texture) {
+				if (e.levels == 0 || mip_chain_size(e.width, e.height, e.levels) != e.size) {
+					invalid_archive(filename, "bad texture size");
+				}
+			}
+
+			std::string name((const char*)base + entry.name_offset, entry.name_length);
+
+			// an asset edited since the last cook is loaded from its file
+			std::string source((const char*)base + entry.source_offset, entry.source_length);
+			std::int64_t mtime = source.empty() ? -1 : file_mtime(source);
+			if (mtime >= 0 && mtime != entry.source_mtime) {
+				std::cerr << "WARNING: " << source << " changed since " << filename << " was cooked, "
+				          << name << " is loaded from the files" << std::endl;
+				continue;
+			}
+
+			entries_[name] = e;
+		}
+
+		file_ = std::move(file);
+		return true;
+	}
+
+	const AssetArchive::Entry* AssetArchive::find(const std::string& name) const {
+		auto found = entries_.find(name);
+		return found == entries_.end() ? nullptr : &found->second;
+	}
+
+	bool AssetArchive::read(const std::string& name, std::string& out) const {
+		const Entry* entry = find(name);
+		if (!entry) return false;
+
+		out.assign((const char*)entry->data, entry->size);
+		return true;
+	}
+
+	void AssetArchive::load_texture(const Entry& entry, Texture2D& texture) const {
+		PROFILE_ZONE("archive texture");
+
+		// the mapping is only paged in by the copy, no decode and no staging
+		texture.image_format = GL_RGBA;
+		texture.internal_format = GL_RGBA;
+		texture.load_levels(entry.width, entry.height, entry.levels, entry.data);
+	}
+
+	void save_asset_archive(const std::vector<CookedAsset>& assets, const std::string& filename) {
+		std::ofstream out(filename, std::ios::binary);
+		if (!out) {
+			std::cerr << "ERROR: failed to open " << filename << " for writing" << std::endl;
+			throw "Failed to write asset archive";
+		}
+
+		uint64_t names_offset = sizeof(ArchiveHeader) + assets.size() * sizeof(ArchiveEntry);
+		uint64_t names_size = 0;
+		for (auto&& asset : assets) names_size += asset.name.size() + asset.source.size();
+
+		// data offset of every asset, the first of identical ones is written
+		std::vector<uint64_t> offsets(assets.size());
+		std::vector<bool> written(assets.size());
+		std::multimap<std::size_t, std::size_t> by_size;
+
+		uint64_t data_end = align(names_offset + names_size);
+		for (std::size_t i = 0; i < assets.size(); i++) {
+			auto&& data = assets[i].data;
+
+			auto range = by_size.equal_range(data.size());
+			auto same = std::find_if(range.first, range.second,
+				[&](const std::pair<const std::size_t, std::size_t>& other) { return assets[other.second].data == data; });
+
+			if (same != range.second) {
+				offsets[i] = offsets[same->second];
+				continue;
+			}
+
+			by_size.emplace(data.size(), i);
+			offsets[i] = data_end;
+			written[i] = true;
+			data_end = align(data_end + data.size());
+		}
+
+		out.write(archive_magic, sizeof(archive_magic));
+		write_pod(out, archive_version);
+		write_pod(out, (uint32_t)assets.size());
+		write_pod(out, (uint32_t)0);
+
+		uint32_t name_offset = (uint32_t)names_offset;
+		uint32_t source_offset = name_offset;
+		for (auto&& asset : assets) source_offset += (uint32_t)asset.name.size();
+
+		for (std::size_t i = 0; i < assets.size(); i++) {
+			auto&& asset = assets[i];
+			write_pod(out, offsets[i]);
+			write_pod(out, (uint64_t)asset.data.size());
+			write_pod(out, name_offset);
+			write_pod(out, (uint32_t)asset.name.size());
+			write_pod(out, (uint32_t)asset.type);
+			write_pod(out, asset.width);
+			write_pod(out, asset.height);
+			write_pod(out, asset.levels);
+			write_pod(out, source_offset);
+			write_pod(out, (uint32_t)asset.source.size());
+			write_pod(out, (int64_t)asset.source_mtime);
+			name_offset += (uint32_t)asset.name.size();
+			source_offset += (uint32_t)asset.source.size();
+		}
+
+		for (auto&& asset : assets) out.write(asset.name.data(), asset.name.size());
+		for (auto&& asset : assets) out.write(asset.source.data(), asset.source.size());
+
+		uint64_t position = names_offset + names_size;
+		for (std::size_t i = 0; i < assets.size(); i++) {
+			if (!written[i]) continue;
+
+			for (; position < offsets[i]; position++) out.put(0);
+			out.write((const char*)assets[i].data.data(), assets[i].data.size());
+			position += assets[i].data.size();
+		}
+		for (; position < data_end; position++) out.put(0);
+
+		if (!out) {
+			std::cerr << "ERROR: failed to write " << filename << std::endl;
+			throw "Failed to write asset archive";
+		}
+	}
+}
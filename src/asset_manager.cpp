@@ -0,0 +1,213 @@
+#include <iostream>
+#include <iterator>
+#include <utility>
+
+#include <lodepng.h>
+
+#include <asset_manager.hpp>
+#include <profiler.hpp>
+
+namespace gl
+{
+	namespace
+	{
+		// FNV-1a, only has to tell files apart, the bytes are compared anyway
+		std::uint64_t hash_bytes(const std::vector<unsigned char>& bytes) {
+			std::uint64_t hash = 14695981039346656037ull;
+			for (unsigned char byte : bytes) {
+				hash = (hash ^ byte) * 1099511628211ull;
+			}
+			return hash;
+		}
+	}
+
+	TextureHandle::TextureHandle(AssetManager* manager, TextureAsset* asset):
+		manager_(manager), asset_(asset) {
+		asset_->refs++;
+	}
+
+	TextureHandle::~TextureHandle() {
+		if (asset_) asset_->refs--;
+	}
+
+	TextureHandle::TextureHandle(const TextureHandle& other):
+		manager_(other.manager_), asset_(other.asset_) {
+		if (asset_) asset_->refs++;
+	}
+
+	TextureHandle::TextureHandle(TextureHandle&& other):
+		manager_(other.manager_), asset_(other.asset_) {
+		other.manager_ = nullptr;
+		other.asset_ = nullptr;
+	}
+
+	TextureHandle& TextureHandle::operator=(TextureHandle other) {
+		std::swap(manager_, other.manager_);
+		std::swap(asset_, other.asset_);
+		return *this;
+	}
+
+	Texture2D& TextureHandle::operator*() const {
+		return manager_->use_(*asset_).texture;
+	}
+
+	AssetManager::AssetManager(TextureLoader& loader, const AssetArchive* archive, std::size_t vram_budget):
+		vram_budget(vram_budget), loader_(loader), archive_(archive) {
+	}
+
+	AssetManager::~AssetManager() {
+		loader_.finish();
+	}
+
+	TextureHandle AssetManager::texture(const std::string& path) {
+		auto found = by_path_.find(path);
+		if (found != by_path_.end()) {
+			path_hits_++;
+			return TextureHandle(this, found->second);
+		}
+
+		PROFILE_ZONE("asset texture");
+
+		const AssetArchive::Entry* cooked = archive_ ? archive_->find(path) : nullptr;
+		if (cooked && cooked->type != AssetArchive::texture) cooked = nullptr;
+
+		std::vector<unsigned char> png;
+		std::uint64_t hash;
+
+		if (cooked) {
+			// the cooker stores identical textures once, at the same offset
+			hash = cooked->offset;
+		} else {
+			unsigned error = lodepng::load_file(png, path);
+			if (error) {
+				std::cerr << "ERROR: failed to load " << path << ": " << lodepng_error_text(error) << std::endl;
+				png.clear();
+			}
+			hash = hash_bytes(png);
+		}
+
+		auto range = by_hash_.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			const TextureAsset& other = *it->second;
+			bool same = cooked
+				? other.cooked && other.cooked->data == cooked->data
+				: !png.empty() && other.png == png;
+
+			if (same) {
+				content_hits_++;
+				by_path_[path] = it->second;
+				return TextureHandle(this, it->second);
+			}
+		}
+
+		lru_.emplace_front();
+		TextureAsset& asset = lru_.front();
+		asset.path = path;
+		asset.hash = hash;
+		asset.png = std::move(png);
+		asset.cooked = cooked;
+		asset.texture.image_format = GL_RGBA;
+		asset.texture.internal_format = GL_RGBA;
+		asset.lru_ = lru_.begin();
+
+		by_path_[path] = &asset;
+		by_hash_.emplace(hash, &asset);
+
+		upload_(asset);
+		return TextureHandle(this, &asset);
+	}
+
+	TextureAsset& AssetManager::use_(TextureAsset& asset) {
+		if (asset.last_used != frame_) {
+			asset.last_used = frame_;
+			lru_.splice(lru_.begin(), lru_, asset.lru_);
+		}
+		if (!asset.resident) upload_(asset);
+		return asset;
+	}
+
+	void AssetManager::upload_(TextureAsset& asset) {
+		asset.resident = true;
+		asset.last_used = frame_;
+
+		if (asset.cooked) {
+			archive_->load_texture(*asset.cooked, asset.texture);
+			return;
+		}
+
+		// unreadable, keeps the placeholder
+		if (asset.png.empty()) {
+			asset.texture.load(1, 1, loader_.placeholder);
+			asset.texture.ready = false;
+			asset.texture.invalid = true;
+			return;
+		}
+
+		loader_.load_png(asset.texture, asset.path, asset.png.data(), asset.png.size());
+	}
+
+	void AssetManager::evict_(TextureAsset& asset) {
+		evictions_++;
+
+		if (asset.refs == 0) {
+			for (auto it = by_path_.begin(); it != by_path_.end();) {
+				if (it->second == &asset) it = by_path_.erase(it);
+				else ++it;
+			}
+
+			auto range = by_hash_.equal_range(asset.hash);
+			for (auto it = range.first; it != range.second; ++it) {
+				if (it->second == &asset) {
+					by_hash_.erase(it);
+					break;
+				}
+			}
+
+			lru_.erase(asset.lru_);
+			return;
+		}
+
+		// handles still refer to it, keep the texture object and free its storage
+		asset.texture.load(1, 1, loader_.placeholder);
+		asset.texture.ready = false;
+		asset.resident = false;
+	}
+
+	void AssetManager::update() {
+		std::size_t gpu_bytes = 0;
+		for (auto&& asset : lru_) {
+			if (asset.resident) gpu_bytes += asset.gpu_bytes();
+		}
+
+		// least recently used first, nothing drawn this frame goes
+		for (auto it = lru_.end(); gpu_bytes > vram_budget && it != lru_.begin();) {
+			TextureAsset& asset = *--it;
+			if (asset.last_used == frame_) break;
+			if (!asset.resident || asset.loading()) continue;
+
+			gpu_bytes -= asset.gpu_bytes();
+			// the asset may be erased, continue from the one after it
+			auto after = std::next(it);
+			evict_(asset);
+			it = after;
+		}
+
+		frame_++;
+	}
+
+	AssetManager::Stats AssetManager::stats() const {
+		Stats stats;
+		for (auto&& asset : lru_) {
+			stats.textures++;
+			stats.cpu_bytes += asset.cpu_bytes();
+			if (asset.resident) {
+				stats.resident++;
+				stats.gpu_bytes += asset.gpu_bytes();
+			}
+		}
+		stats.path_hits = path_hits_;
+		stats.content_hits = content_hits_;
+		stats.evictions = evictions_;
+		return stats;
+	}
+}
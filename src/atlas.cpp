@@ -0,0 +1,318 @@
+#include <algorithm>
+#include <iostream>
+
+#include <lodepng.h>
+
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <stb_rect_pack.h>
+
+#include <atlas.hpp>
+#include <profiler.hpp>
+
+namespace gl
+{
+	const int TextureAtlas::late_page_size;
+
+	AtlasBuilder::AtlasBuilder(int page_width, int page_height, int padding):
+		page_width(page_width), page_height(page_height), padding(padding) {
+	}
+
+	void AtlasBuilder::add(int id, int width, int height) {
+		images_.push_back({ id, width, height, {} });
+	}
+
+	void AtlasBuilder::add(int id, int width, int height, std::vector<unsigned char> pixels) {
+		images_.push_back({ id, width, height, std::move(pixels) });
+	}
+
+	bool AtlasBuilder::add_png(int id, const std::string& filename) {
+		PROFILE_ZONE("atlas add_png");
+
+		std::vector<unsigned char> pixels;
+		unsigned width, height;
+
+		unsigned error = lodepng::decode(pixels, width, height, filename);
+		if (error) {
+			std::cerr << "ERROR: atlas failed to load " << filename << ": " << lodepng_error_text(error) << std::endl;
+			return false;
+		}
+
+		premultiply_alpha(pixels.data(), pixels.size() / 4);
+		add(id, (int)width, (int)height, std::move(pixels));
+		return true;
+	}
+
+	void AtlasBuilder::pack() {
+		PROFILE_ZONE("atlas pack");
+
+		regions.clear();
+		page_count = 0;
+		page_heights.clear();
+		tile_count = 0;
+
+		std::vector<stbrp_rect> pending;
+		for (std::size_t i = 0; i < images_.size(); i++) {
+			auto&& image = images_[i];
+
+			if (is_tile_(image)) {
+				AtlasRegion region;
+				region.page = -1;
+				region.slice = tile_count++;
+				region.x = region.y = 0;
+				region.width = image.width;
+				region.height = image.height;
+				region.uv = glm::vec4(0, 0, 1, 1);
+
+				regions[image.id] = region;
+				continue;
+			}
+
+			int w = image.width + 2 * padding;
+			int h = image.height + 2 * padding;
+			if (w > page_width || h > page_height) {
+				std::cerr << "ERROR: image " << image.id << " (" << image.width << "x" << image.height
+				          << ") does not fit into a " << page_width << "x" << page_height << " atlas page" << std::endl;
+				throw "Atlas page too small";
+			}
+
+			stbrp_rect rect{};
+			rect.id = (int)i;
+			rect.w = (stbrp_coord)w;
+			rect.h = (stbrp_coord)h;
+			pending.push_back(rect);
+		}
+
+		std::vector<stbrp_node> nodes(page_width);
+
+		while (!pending.empty()) {
+			stbrp_context context;
+			stbrp_init_target(&context, page_width, page_height, nodes.data(), (int)nodes.size());
+			stbrp_pack_rects(&context, pending.data(), (int)pending.size());
+
+			int used = 1;
+			for (auto&& rect : pending) {
+				if (rect.was_packed) used = std::max(used, rect.y + rect.h);
+			}
+
+			int height = 1;
+			while (height < used) height *= 2;
+			height = std::min(height, page_height);
+			page_heights.push_back(height);
+
+			for (auto&& rect : pending) {
+				if (!rect.was_packed) continue;
+
+				auto&& image = images_[rect.id];
+
+				AtlasRegion region;
+				region.page = page_count;
+				region.slice = 0;
+				region.x = rect.x + padding;
+				region.y = rect.y + padding;
+				region.width = image.width;
+				region.height = image.height;
+				region.uv = glm::vec4(
+					(float)region.x / page_width,
+					(float)region.y / height,
+					(float)(region.x + region.width) / page_width,
+					(float)(region.y + region.height) / height);
+
+				regions[image.id] = region;
+			}
+
+			pending.erase(std::remove_if(pending.begin(), pending.end(),
+				[](const stbrp_rect& r) { return r.was_packed != 0; }), pending.end());
+
+			page_count++;
+		}
+	}
+
+	void extrude_image(const unsigned char* pixels, int width, int height, int padding,
+		unsigned char* dst, std::size_t stride) {
+		for (int y = -padding; y < height + padding; y++) {
+			int src_y = std::min(std::max(y, 0), height - 1);
+
+			for (int x = -padding; x < width + padding; x++) {
+				int src_x = std::min(std::max(x, 0), width - 1);
+
+				const unsigned char* src = &pixels[4 * ((std::size_t)src_y * width + src_x)];
+				std::copy(src, src + 4, &dst[4 * ((std::size_t)(y + padding) * stride + x + padding)]);
+			}
+		}
+	}
+
+	std::vector<std::vector<unsigned char>> AtlasBuilder::compose() const {
+		std::vector<std::vector<unsigned char>> pages(page_count);
+		for (int i = 0; i < page_count; i++) {
+			pages[i].assign((std::size_t)page_width * page_heights[i] * 4, 0);
+		}
+
+		for (auto&& image : images_) {
+			if (image.pixels.empty()) continue;
+
+			auto it = regions.find(image.id);
+			if (it == regions.end()) continue;
+
+			auto&& region = it->second;
+			if (region.page < 0) continue;
+
+			auto&& page = pages[region.page];
+
+			std::size_t corner = (std::size_t)(region.y - padding) * page_width + region.x - padding;
+			extrude_image(image.pixels.data(), image.width, image.height, padding, &page[4 * corner], page_width);
+		}
+
+		return pages;
+	}
+
+	std::vector<unsigned char> AtlasBuilder::compose_tiles() const {
+		std::size_t layer_size = mip_chain_size(tile_width, tile_height, mip_levels(tile_width, tile_height));
+		std::vector<unsigned char> layers(layer_size * tile_count, 0);
+
+		for (auto&& image : images_) {
+			if (image.pixels.empty() || !is_tile_(image)) continue;
+
+			auto it = regions.find(image.id);
+			if (it == regions.end()) continue;
+
+			std::uint32_t levels;
+			auto chain = build_mip_chain(image.pixels, tile_width, tile_height, levels);
+			std::copy(chain.begin(), chain.end(), layers.begin() + layer_size * it->second.slice);
+		}
+
+		return layers;
+	}
+
+	namespace
+	{
+		Texture2D make_page(int width, int height, const unsigned char* pixels) {
+			Texture2D page;
+			page.internal_format = GL_RGBA;
+			page.image_format = GL_RGBA;
+			page.wrap_s = GL_CLAMP_TO_EDGE;
+			page.wrap_t = GL_CLAMP_TO_EDGE;
+			page.load(width, height, const_cast<unsigned char*>(pixels));
+			return page;
+		}
+	}
+
+	void TextureAtlas::load(const AtlasBuilder& builder) {
+		PROFILE_ZONE("atlas upload");
+
+		regions = builder.regions;
+		padding = builder.padding;
+		pages.clear();
+		late_page_ = -1;
+
+		auto composed = builder.compose();
+		for (std::size_t i = 0; i < composed.size(); i++) {
+			pages.push_back(make_page(builder.page_width, builder.page_heights[i], composed[i].data()));
+		}
+
+		// only the tiles in use, insert() grows the array for the others
+		tile_width_ = builder.tile_width;
+		tile_height_ = builder.tile_height;
+		tiles_used_ = builder.tile_count;
+		if (tiles_used_ > 0 && tile_width_ > 0) {
+			GLuint levels = mip_levels(tile_width_, tile_height_);
+			tiles.load(tile_width_, tile_height_, tiles_used_, levels, builder.compose_tiles().data());
+		}
+	}
+
+	bool TextureAtlas::grow_tiles_() {
+		GLint max_layers;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+		int layers = std::min(std::max(4, (int)tiles.layers * 2), max_layers);
+		if (layers <= (int)tiles.layers) return false;
+
+		if (tiles.layers == 0) tiles.load(tile_width_, tile_height_, layers, mip_levels(tile_width_, tile_height_), nullptr);
+		else tiles.resize(layers);
+		return true;
+	}
+
+	const AtlasRegion& TextureAtlas::insert(int id, int width, int height, const unsigned char* pixels) {
+		PROFILE_ZONE("atlas insert");
+
+		bool tile = tile_width_ > 0 && width == tile_width_ && height == tile_height_;
+		if (tile && (tiles_used_ < (int)tiles.layers || grow_tiles_())) {
+			AtlasRegion region;
+			region.page = -1;
+			region.slice = tiles_used_++;
+			region.x = region.y = 0;
+			region.width = width;
+			region.height = height;
+			region.uv = glm::vec4(0, 0, 1, 1);
+
+			std::uint32_t levels;
+			std::vector<unsigned char> image(pixels, pixels + (std::size_t)width * height * 4);
+			tiles.load_layer(region.slice, build_mip_chain(image, width, height, levels).data());
+
+			revision++;
+			return regions[id] = region;
+		}
+
+		int w = width + 2 * padding;
+		int h = height + 2 * padding;
+
+		if (late_page_ >= 0) {
+			const Texture2D& page = pages[late_page_];
+			if (shelf_x_ + w > (int)page.width) {
+				shelf_x_ = 0;
+				shelf_y_ += shelf_height_;
+				shelf_height_ = 0;
+			}
+			if (shelf_x_ + w > (int)page.width || shelf_y_ + h > (int)page.height) late_page_ = -1;
+		}
+
+		if (late_page_ < 0) {
+			int page_width = std::max(late_page_size, w);
+			int page_height = std::max(late_page_size, h);
+
+			std::vector<unsigned char> blank((std::size_t)page_width * page_height * 4, 0);
+			pages.push_back(make_page(page_width, page_height, blank.data()));
+
+			late_page_ = (int)pages.size() - 1;
+			shelf_x_ = shelf_y_ = shelf_height_ = 0;
+		}
+
+		Texture2D& page = pages[late_page_];
+
+		AtlasRegion region;
+		region.page = late_page_;
+		region.slice = 0;
+		region.x = shelf_x_ + padding;
+		region.y = shelf_y_ + padding;
+		region.width = width;
+		region.height = height;
+		region.uv = glm::vec4(
+			(float)region.x / page.width,
+			(float)region.y / page.height,
+			(float)(region.x + width) / page.width,
+			(float)(region.y + height) / page.height);
+
+		shelf_x_ += w;
+		shelf_height_ = std::max(shelf_height_, h);
+
+		std::vector<unsigned char> padded((std::size_t)w * h * 4);
+		extrude_image(pixels, width, height, padding, padded.data(), w);
+
+		page.bind();
+		glTexSubImage2D(GL_TEXTURE_2D, 0, shelf_x_ - w, shelf_y_, w, h, page.image_format, GL_UNSIGNED_BYTE, padded.data());
+
+		revision++;
+		return regions[id] = region;
+	}
+
+	std::size_t TextureAtlas::gpu_bytes() const {
+		std::size_t bytes = mip_chain_size(tiles.width, tiles.height, tiles.levels) * tiles.layers;
+		for (auto&& page : pages) bytes += (std::size_t)page.width * page.height * 4;
+		return bytes;
+	}
+
+	const AtlasRegion* TextureAtlas::find(int id) const {
+		auto it = regions.find(id);
+		return it == regions.end() ? nullptr : &it->second;
+	}
+}
@@ -6,20 +6,31 @@
 #include <math.h>
 #include <fstream>
 #include <iterator>
+#include <cstring>
+#include <algorithm>
 #include <sstream>
+#include <utility>
 #include <lodepng.h>
 
 #include <gl_utils.hpp>
+#include <radix_sort.hpp>
+#include <profiler.hpp>
+
+// set by gl::ShaderSources
+static gl::ShaderReader shader_reader;
 
 GLuint load_and_compile_shader_(const GLchar* path, GLenum shaderType) {
 	using namespace std;
 
-	ifstream file(path);
+	string code;
+	if (!shader_reader || !shader_reader(path, code)) {
+		ifstream file(path);
 
-	stringstream str;
-	str << file.rdbuf();
+		stringstream str;
+		str << file.rdbuf();
 
-	string code = str.str();
+		code = str.str();
+	}
 	// cout << code << endl << endl;
 	const GLchar* code_c = code.c_str();
 
@@ -43,6 +54,166 @@ GLuint load_and_compile_shader_(const GLchar* path, GLenum shaderType) {
 
 namespace gl
 {
+	Extensions ext;
+
+	void load_extensions(GLADloadproc load) {
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+		if (major > 4 || (major == 4 && minor >= 4) || has_extension("GL_ARB_buffer_storage")) {
+			ext.buffer_storage = (PFNGLBUFFERSTORAGEPROC)load("glBufferStorage");
+		}
+
+		if (major > 4 || (major == 4 && minor >= 2) || has_extension("GL_ARB_texture_storage")) {
+			ext.tex_storage_2d = (PFNGLTEXSTORAGE2DPROC)load("glTexStorage2D");
+			ext.tex_storage_3d = (PFNGLTEXSTORAGE3DPROC)load("glTexStorage3D");
+		}
+	}
+
+	bool has_extension(const char* name) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+
+		for (GLint i = 0; i < count; i++) {
+			if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0) return true;
+		}
+
+		return false;
+	}
+
+	const int StateCache::max_texture_units;
+	const GLushort PackedVertex::texture_bit;
+	const GLuint StateCache::unknown;
+
+	StateCache::StateCache() {
+		invalidate();
+	}
+
+	bool StateCache::elide_(GLuint& current, GLuint value) {
+		if (current == value) {
+			binds_elided++;
+			return true;
+		}
+
+		current = value;
+		binds_issued++;
+		return false;
+	}
+
+	void StateCache::use_program(GLuint program) {
+		if (!elide_(program_, program)) glUseProgram(program);
+	}
+
+	void StateCache::bind_vertex_array(GLuint vao) {
+		if (elide_(vertex_array_, vao)) return;
+
+		glBindVertexArray(vao);
+
+		// the element array binding is part of the VAO
+		buffers_[GL_ELEMENT_ARRAY_BUFFER] = unknown;
+	}
+
+	void StateCache::bind_buffer(GLenum target, GLuint buffer) {
+		auto it = buffers_.find(target);
+		if (it == buffers_.end()) it = buffers_.emplace(target, unknown).first;
+
+		if (!elide_(it->second, buffer)) glBindBuffer(target, buffer);
+	}
+
+	void StateCache::active_texture(GLenum unit) {
+		if (!elide_(active_unit_, unit)) glActiveTexture(unit);
+	}
+
+	void StateCache::bind_texture(GLenum target, GLuint texture) {
+		if (active_unit_ == unknown) active_texture(GL_TEXTURE0);
+
+		auto&& unit = textures_[active_unit_ - GL_TEXTURE0];
+		auto it = unit.find(target);
+		if (it == unit.end()) it = unit.emplace(target, unknown).first;
+
+		if (!elide_(it->second, texture)) glBindTexture(target, texture);
+	}
+
+	void StateCache::forget_program(GLuint program) {
+		if (program_ == program) program_ = unknown;
+	}
+
+	void StateCache::forget_vertex_array(GLuint vao) {
+		if (vertex_array_ == vao) vertex_array_ = unknown;
+	}
+
+	void StateCache::forget_buffer(GLuint buffer) {
+		for (auto&& b : buffers_) {
+			if (b.second == buffer) b.second = unknown;
+		}
+	}
+
+	void StateCache::forget_texture(GLuint texture) {
+		for (auto&& unit : textures_) {
+			for (auto&& t : unit) {
+				if (t.second == texture) t.second = unknown;
+			}
+		}
+	}
+
+	void StateCache::invalidate() {
+		program_ = unknown;
+		vertex_array_ = unknown;
+		active_unit_ = unknown;
+		buffers_.clear();
+		for (auto&& unit : textures_) unit.clear();
+	}
+
+	void StateCache::reset_counters() {
+		binds_issued = 0;
+		binds_elided = 0;
+	}
+
+	StateCache& state_cache() {
+		static StateCache cache;
+		return cache;
+	}
+
+	const GLsizei QuadIndexBuffer::max_quads;
+
+	QuadIndexBuffer::QuadIndexBuffer() {
+		std::vector<GLushort> indices;
+		indices.reserve(max_quads * 6);
+
+		for (GLsizei quad = 0; quad < max_quads; quad++) {
+			GLushort first = (GLushort)(quad * 4);
+			for (GLushort corner : { 0, 1, 2, 0, 2, 3 }) {
+				indices.push_back(first + corner);
+			}
+		}
+
+		glGenBuffers(1, &id);
+		bind();
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+	}
+
+	QuadIndexBuffer::~QuadIndexBuffer() {
+		state_cache().forget_buffer(id);
+		glDeleteBuffers(1, &id);
+	}
+
+	int QuadIndexBuffer::draw(GLint first_vertex, GLsizei count) const {
+		int draws = 0;
+		for (GLsizei done = 0; done < count; done += max_quads) {
+			GLsizei quads = std::min(count - done, max_quads);
+			glDrawElementsBaseVertex(GL_TRIANGLES, quads * 6, GL_UNSIGNED_SHORT, nullptr, first_vertex + done * 4);
+			draws++;
+		}
+		return draws;
+	}
+
+	QuadIndexBuffer& quad_indices() {
+		// never destroyed, static destructors run after the context is gone
+		static QuadIndexBuffer* indices = new QuadIndexBuffer();
+		return *indices;
+	}
+
 	void Camera::update_camera() {
 		translate_ += current_scroll_;
 
@@ -60,6 +231,23 @@ namespace gl
 		return projection_;
 	}
 
+	glm::vec4 Camera::visible_rect(const glm::mat4& base) const {
+		glm::mat4 inverse = glm::inverse(projection_ * base);
+
+		glm::vec2 lo(INFINITY), hi(-INFINITY);
+		for (float x : { -1.0f, 1.0f }) {
+			for (float y : { -1.0f, 1.0f }) {
+				glm::vec4 p = inverse * glm::vec4(x, y, 0, 1);
+				glm::vec2 world = glm::vec2(p) / p.w;
+
+				lo = glm::min(lo, world);
+				hi = glm::max(hi, world);
+			}
+		}
+
+		return glm::vec4(lo, hi);
+	}
+
 	float* Camera::value_ptr() {
 		return glm::value_ptr(projection_);
 	}
@@ -99,9 +287,97 @@ namespace gl
 		zoom_level_ += 0.07f * direction;
 	}
 
+	StreamBuffer::StreamBuffer(GLsizeiptr size, GLenum target): target(target), size(size) {
+		glGenBuffers(1, &id);
+		bind();
+
+		if (ext.buffer_storage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			ext.buffer_storage(target, size, nullptr, flags);
+			mapped_ = (unsigned char*)glMapBufferRange(target, 0, size, flags);
+		} else {
+			glBufferData(target, size, nullptr, GL_STREAM_DRAW);
+		}
+	}
+
+	StreamBuffer::~StreamBuffer() {
+		for (auto&& fence : fences_) {
+			if (fence) glDeleteSync(fence);
+		}
+
+		if (mapped_) {
+			bind();
+			glUnmapBuffer(target);
+		}
+
+		state_cache().forget_buffer(id);
+		glDeleteBuffers(1, &id);
+	}
+
+	void StreamBuffer::fence_(int segment) {
+		if (fences_[segment]) glDeleteSync(fences_[segment]);
+		fences_[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	void StreamBuffer::wait_(int segment) {
+		GLsync& fence = fences_[segment];
+		if (!fence) return;
+
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED) {}
+
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+
+	GLintptr StreamBuffer::write(const void* data, GLsizeiptr bytes, GLsizeiptr alignment) {
+		if (bytes > size) {
+			std::cerr << "ERROR: " << bytes << " bytes do not fit into a stream buffer of " << size << " bytes" << std::endl;
+			throw "StreamBuffer too small";
+		}
+
+		GLsizeiptr offset = (head_ + alignment - 1) / alignment * alignment;
+		bool wrap = offset + bytes > size;
+		if (wrap) offset = 0;
+
+		if (mapped_) {
+			int first = segment_(offset);
+			int last = segment_(offset + bytes - 1);
+
+			// Leaving the segments written since the last fence: everything
+			// drawn from them so far is behind a fence of each, a write that
+			// spanned several leaves them all unfenced until here.
+			if (unfenced_end_ > unfenced_begin_ && (wrap || first != unfenced_end_ - 1)) {
+				for (int i = unfenced_begin_; i < unfenced_end_; i++) fence_(i);
+				unfenced_begin_ = unfenced_end_ = 0;
+			}
+
+			// wait for each segment before writing into it again, except the
+			// one still being written
+			for (int i = first; i <= last; i++) {
+				if (i < unfenced_begin_ || i >= unfenced_end_) wait_(i);
+			}
+
+			memcpy(mapped_ + offset, data, bytes);
+
+			if (unfenced_end_ == unfenced_begin_) unfenced_begin_ = first;
+			unfenced_end_ = last + 1;
+		} else {
+			bind();
+			if (wrap) glBufferData(target, size, nullptr, GL_STREAM_DRAW);
+
+			GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+			void* dst = glMapBufferRange(target, offset, bytes, access);
+			memcpy(dst, data, bytes);
+			glUnmapBuffer(target);
+		}
+
+		head_ = offset + bytes;
+		return offset;
+	}
+
 	Texture2D::Texture2D():
 		width(0), height(0),
-		internal_format(GL_RGB), image_format(GL_RGB),
+		internal_format(GL_RGB), image_format(GL_RGB), pixel_type(GL_UNSIGNED_BYTE),
 		wrap_s(GL_REPEAT), wrap_t(GL_REPEAT),
 		filter_min(GL_LINEAR), filter_mag(GL_LINEAR) {
 	}
@@ -133,34 +409,251 @@ namespace gl
 	//}
 
 
+	void premultiply_alpha(unsigned char* pixels, std::size_t count) {
+		for (std::size_t i = 0; i < count; i++, pixels += 4) {
+			unsigned alpha = pixels[3];
+			if (alpha == 255) continue;
+
+			for (int c = 0; c < 3; c++) pixels[c] = (unsigned char)((pixels[c] * alpha + 127) / 255);
+		}
+	}
+
+	std::uint32_t mip_levels(std::uint32_t width, std::uint32_t height) {
+		std::uint32_t levels = 1;
+		for (std::uint32_t size = std::max(width, height); size > 1; size /= 2) levels++;
+		return levels;
+	}
+
+	std::size_t mip_chain_size(std::uint32_t width, std::uint32_t height, std::uint32_t levels) {
+		std::size_t size = 0;
+		for (std::uint32_t level = 0; level < levels; level++) {
+			size += (std::size_t)std::max(1u, width >> level) * std::max(1u, height >> level) * 4;
+		}
+		return size;
+	}
+
+	std::vector<unsigned char> build_mip_chain(const std::vector<unsigned char>& pixels,
+		std::uint32_t width, std::uint32_t height, std::uint32_t& levels) {
+		std::vector<unsigned char> chain;
+		chain.reserve(mip_chain_size(width, height, mip_levels(width, height)));
+		chain.assign(pixels.begin(), pixels.end());
+		levels = 1;
+
+		std::size_t previous = 0;
+		std::uint32_t w = width, h = height;
+
+		while (w > 1 || h > 1) {
+			std::uint32_t nw = std::max(1u, w / 2), nh = std::max(1u, h / 2);
+			std::size_t offset = chain.size();
+			chain.resize(offset + (std::size_t)nw * nh * 4);
+
+			const unsigned char* src = chain.data() + previous;
+			unsigned char* dst = chain.data() + offset;
+
+			// 2x2 box, odd edges repeat the last row or column
+			for (std::uint32_t y = 0; y < nh; y++) {
+				std::uint32_t y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+				for (std::uint32_t x = 0; x < nw; x++) {
+					std::uint32_t x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+					for (int c = 0; c < 4; c++) {
+						unsigned sum = src[(y0 * w + x0) * 4 + c] + src[(y0 * w + x1) * 4 + c]
+						             + src[(y1 * w + x0) * 4 + c] + src[(y1 * w + x1) * 4 + c];
+						dst[(y * nw + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+					}
+				}
+			}
+
+			previous = offset;
+			w = nw;
+			h = nh;
+			levels++;
+		}
+
+		return chain;
+	}
+
+	namespace
+	{
+		// glTexStorage only takes sized formats
+		GLenum sized_format(GLenum format) {
+			switch (format) {
+			case GL_RGBA: return GL_RGBA8;
+			case GL_RGB: return GL_RGB8;
+			case GL_RED: return GL_R8;
+			default: return format;
+			}
+		}
+
+		GLint min_filter(GLuint filter, GLuint levels) {
+			return levels > 1 && filter == GL_LINEAR ? GL_LINEAR_MIPMAP_LINEAR : filter;
+		}
+	}
+
 	void Texture2D::load_png(const std::string& filename) {
+		PROFILE_ZONE("load_png");
+
 		std::vector<unsigned char> data;
 		lodepng::decode(data, width, height, filename);
+		premultiply_alpha(data.data(), data.size() / 4);
 		load(width, height, data.data());
 	}
 
 	void Texture2D::load(GLuint width, GLuint height, unsigned char* data) {
+		// storage of a fixed size cannot be specified again
+		if (immutable) {
+			id = TextureID();
+			immutable = false;
+		}
+
 		this->width = width;
 		this->height = height;
+		levels = 1;
+		ready = true;
 
-		glBindTexture(GL_TEXTURE_2D, id);
-		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, image_format, GL_UNSIGNED_BYTE, data);
+		state_cache().bind_texture(GL_TEXTURE_2D, id);
+		glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, image_format, pixel_type, data);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_t);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter_min);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_mag);
+	}
+
+	void Texture2D::load_levels(GLuint width, GLuint height, GLuint levels, const unsigned char* data) {
+		if (immutable) id = TextureID();
+
+		this->width = width;
+		this->height = height;
+		this->levels = levels;
+		ready = true;
+
+		state_cache().bind_texture(GL_TEXTURE_2D, id);
+
+		if (ext.tex_storage_2d) {
+			ext.tex_storage_2d(GL_TEXTURE_2D, levels, sized_format(internal_format), width, height);
+			immutable = true;
+		}
+
+		for (GLuint level = 0; level < levels; level++) {
+			GLsizei w = std::max(1u, width >> level), h = std::max(1u, height >> level);
+			if (immutable) {
+				glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, image_format, pixel_type, data);
+			} else {
+				glTexImage2D(GL_TEXTURE_2D, level, internal_format, w, h, 0, image_format, pixel_type, data);
+			}
+			data += (std::size_t)w * h * 4;
+		}
 
-		glBindTexture(GL_TEXTURE_2D, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap_s);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap_t);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, min_filter(filter_min, levels));
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_mag);
 	}
 
 	void Texture2D::bind() const {
-		glBindTexture(GL_TEXTURE_2D, id);
+		state_cache().bind_texture(GL_TEXTURE_2D, id);
+	}
+
+	Texture2DArray::Texture2DArray():
+		width(0), height(0), layers(0),
+		internal_format(GL_RGBA), image_format(GL_RGBA),
+		wrap_s(GL_CLAMP_TO_EDGE), wrap_t(GL_CLAMP_TO_EDGE),
+		filter_min(GL_LINEAR), filter_mag(GL_LINEAR) {
+	}
+
+	void Texture2DArray::load(GLuint width, GLuint height, GLuint layers, GLuint levels, const unsigned char* data) {
+		// a new object, storage of a fixed size cannot be specified again
+		if (this->layers > 0) id = TextureID();
+
+		this->width = width;
+		this->height = height;
+		this->layers = layers;
+		this->levels = levels;
+
+		bind();
+		if (ext.tex_storage_3d) {
+			ext.tex_storage_3d(GL_TEXTURE_2D_ARRAY, levels, sized_format(internal_format), width, height, layers);
+		} else {
+			for (GLuint level = 0; level < levels; level++) {
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internal_format,
+					std::max(1u, width >> level), std::max(1u, height >> level), layers, 0,
+					image_format, GL_UNSIGNED_BYTE, nullptr);
+			}
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, wrap_s);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, wrap_t);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min_filter(filter_min, levels));
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filter_mag);
+
+		if (!data) return;
+
+		std::size_t layer_size = mip_chain_size(width, height, levels);
+		for (GLuint layer = 0; layer < layers; layer++) {
+			load_layer(layer, data + layer * layer_size);
+		}
+	}
+
+	void Texture2DArray::load_layer(GLuint layer, const unsigned char* data) {
+		bind();
+		for (GLuint level = 0; level < levels; level++) {
+			GLsizei w = std::max(1u, width >> level), h = std::max(1u, height >> level);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, w, h, 1, image_format, GL_UNSIGNED_BYTE, data);
+			data += (std::size_t)w * h * 4;
+		}
+	}
+
+	void Texture2DArray::resize(GLuint layers) {
+		// nothing to copy from an array without storage
+		if (this->layers == 0) {
+			load(width, height, layers, levels, nullptr);
+			return;
+		}
+
+		TextureID old = std::move(id);
+		GLuint kept = std::min(this->layers, layers);
+		load(width, height, layers, levels, nullptr);
+
+		// glCopyImageSubData is GL 4.3, read every layer and level of the old
+		// array through a framebuffer instead
+		GLint read_framebuffer;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_framebuffer);
+		GLuint framebuffer;
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+
+		bind();
+		for (GLuint level = 0; level < levels; level++) {
+			GLsizei w = std::max(1u, width >> level), h = std::max(1u, height >> level);
+			for (GLuint layer = 0; layer < kept; layer++) {
+				glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, old, level, layer);
+				glCopyTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, 0, 0, w, h);
+			}
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, read_framebuffer);
+		glDeleteFramebuffers(1, &framebuffer);
+	}
+
+	void Texture2DArray::bind() const {
+		state_cache().bind_texture(GL_TEXTURE_2D_ARRAY, id);
+	}
+
+	ShaderSources::ShaderSources(ShaderReader reader): previous_(std::move(shader_reader)) {
+		shader_reader = std::move(reader);
+	}
+
+	ShaderSources::~ShaderSources() {
+		shader_reader = std::move(previous_);
 	}
 
 	Shader::Shader(std::string name): Shader(name + ".vs.glsl", name + ".fs.glsl") { }
 
 	Shader::Shader(std::string vertexPath, std::string fragmentPath) {
+		PROFILE_ZONE("shader");
+
 		using namespace std;
 
 		GLuint vertex = load_and_compile_shader_(vertexPath.c_str(), GL_VERTEX_SHADER);
@@ -181,108 +674,400 @@ namespace gl
 
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
+
+		reflect_uniforms_();
+	}
+
+	Shader::~Shader() {
+		state_cache().forget_program(program);
+		glDeleteProgram(program);
+	}
+
+	void Shader::reflect_uniforms_() {
+		GLint count = 0, max_length = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+
+		std::vector<GLchar> name(max_length + 1);
+
+		for (GLint i = 0; i < count; i++) {
+			GLsizei length = 0;
+			GLint size;
+			GLenum type;
+			glGetActiveUniform(program, (GLuint)i, (GLsizei)name.size(), &length, &size, &type, name.data());
+
+			// members of uniform blocks have no location
+			GLint location = glGetUniformLocation(program, name.data());
+			if (location == -1) continue;
+
+			std::string uniform_name(name.data(), length);
+			uniforms[uniform_name] = location;
+
+			auto bracket = uniform_name.find("[0]");
+			if (bracket != std::string::npos && bracket + 3 == uniform_name.size()) {
+				uniforms[uniform_name.substr(0, bracket)] = location;
+			}
+		}
 	}
 
-	Shader::~Shader() { glDeleteProgram(program); }
+	Uniform Shader::uniform(const GLchar* name) const {
+		auto it = uniforms.find(name);
+		return it == uniforms.end() ? Uniform() : Uniform(it->second);
+	}
 
-	void Shader::set(const GLchar* name, int value) {
+	void Shader::set(Uniform uniform, int value) {
 		use();
-		glUniform1i(glGetUniformLocation(program, name), value);
+		glUniform1i(uniform.location, value);
 	}
 
-	void Shader::set(const GLchar* name, float value) {
+	void Shader::set(Uniform uniform, float value) {
 		use();
-		glUniform1f(glGetUniformLocation(program, name), value);
+		glUniform1f(uniform.location, value);
 	}
 
-	void Shader::set(const GLchar* name, const glm::vec2& v) {
+	void Shader::set(Uniform uniform, const glm::vec2& v) {
 		use();
-		glUniform2f(glGetUniformLocation(program, name), v.x, v.y);
+		glUniform2f(uniform.location, v.x, v.y);
 	}
 
-	void Shader::set(const GLchar* name, const glm::vec3& v) {
+	void Shader::set(Uniform uniform, const glm::vec3& v) {
 		use();
-		glUniform3f(glGetUniformLocation(program, name), v.x, v.y, v.z);
+		glUniform3f(uniform.location, v.x, v.y, v.z);
 	}
 
-	void Shader::set(const GLchar* name, const glm::vec4& v) {
+	void Shader::set(Uniform uniform, const glm::vec4& v) {
 		use();
-		glUniform4f(glGetUniformLocation(program, name), v.x, v.y, v.z, v.w);
+		glUniform4f(uniform.location, v.x, v.y, v.z, v.w);
 	}
 
-	void Shader::set(const GLchar* name, const glm::mat4& matrix) {
+	void Shader::set(Uniform uniform, const glm::mat4& matrix) {
 		use();
-		glUniformMatrix4fv(glGetUniformLocation(program, name), 1, GL_FALSE, glm::value_ptr(matrix));
+		glUniformMatrix4fv(uniform.location, 1, GL_FALSE, glm::value_ptr(matrix));
 	}
 
-	void Shader::use() { glUseProgram(program); }
+	void Shader::use() { state_cache().use_program(program); }
+
+	void SpriteBatch::clear() {
+		queued_.clear();
+		keys_.clear();
+		instances.clear();
+		groups.clear();
+	}
+
+	void SpriteBatch::reserve(std::size_t sprites) {
+		queued_.reserve(sprites);
+		keys_.reserve(sprites);
+		scratch_.reserve(sprites);
+		instances.reserve(sprites);
+	}
+
+	void SpriteBatch::push(GLuint texture, const SpriteInstance& instance, std::uint8_t layer, float depth, GLenum target,
+	                       std::uint8_t order) {
+		// texture names are shared by all targets, the name alone tells them apart
+		keys_.push_back({ sort_key(layer, depth, order, texture), (std::uint32_t)queued_.size() });
+		queued_.push_back({ texture, target, instance });
+	}
+
+	std::uint64_t SpriteBatch::sort_key(std::uint8_t layer, float depth, std::uint8_t order, GLuint texture) {
+		const std::int64_t max_depth = (1 << 24) - 1;
+		std::int64_t fixed = (std::int64_t)std::floor(depth * 2.0f) + (1 << 23);
+		std::uint64_t d = (std::uint64_t)std::min(std::max(fixed, (std::int64_t)0), max_depth);
+
+		return (std::uint64_t)layer << 56 | d << 32 | (std::uint64_t)order << 24 | (texture & 0xffffff);
+	}
+
+	void SpriteBatch::sort() {
+		radix_sort(keys_, scratch_, [](const Key& k) { return k.key; });
+
+		instances.clear();
+		groups.clear();
+
+		for (auto&& k : keys_) {
+			const Queued& q = queued_[k.index];
+			if (groups.empty() || groups.back().texture != q.texture) {
+				groups.push_back({ q.texture, q.target, instances.size(), 0 });
+			}
+
+			groups.back().count++;
+			instances.push_back(q.instance);
+		}
+	}
+
+	RenderStats SpriteBatch::cost() const {
+		RenderStats cost;
+		if (groups.empty()) return cost;
+
+		// Program, VAO and instance buffer upload once per batch, then a texture
+		// bind and a rebase of the instance attributes for every group.
+		cost.state_changes = 3 + 2 * (int)groups.size();
+		cost.draw_calls = (int)groups.size();
+
+		// and the sampler switch between texture arrays and plain textures
+		for (std::size_t i = 1; i < groups.size(); i++) {
+			if (groups[i].target != groups[i - 1].target) cost.state_changes++;
+		}
+		return cost;
+	}
 
 	SpriteRenderer::SpriteRenderer(Shader& shader): shader(shader) {
+		// corners of the quad, drawn through quad_indices()
 		GLfloat vertices[] = {
-			0, 1, 0, 1,
-			1, 0, 1, 0,
 			0, 0, 0, 0,
-
-			0, 1, 0, 1,
+			1, 0, 1, 0,
 			1, 1, 1, 1,
-			1, 0, 1, 0
+			0, 1, 0, 1
 		};
 
 		vbo.bind();
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
 		vao.bind();
+		quad_indices().bind();
 		glEnableVertexAttribArray(0);
 		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(GLfloat), (GLvoid*)0);
 
+		instances.bind();
+		for (GLuint i = 1; i <= 4; i++) {
+			glEnableVertexAttribArray(i);
+			glVertexAttribDivisor(i, 1);
+		}
+
 		vbo.unbind();
 		vao.unbind();
+
+		// arrays are bound to unit 1, so both samplers can stay bound
+		array_ = shader.uniform("array");
+		shader.set("image", 0);
+		shader.set("tiles", 1);
+		shader.set(array_, 0);
+	}
+
+	void SpriteRenderer::begin() {
+		batch.clear();
+		batching = true;
+	}
+
+	void SpriteRenderer::end() {
+		batching = false;
+		flush();
 	}
 
 	void SpriteRenderer::draw_sprite(Texture2D& texture, glm::vec2 pos, glm::vec2 size, glm::vec3 color)
 	{
-		shader.use();
-		glm::mat4 model(1.0f);
+		draw_sprite(texture, glm::vec4(0, 0, 1, 1), pos, size, color);
+	}
 
-		model = glm::translate(model, glm::vec3(pos, 0.0f));
-		model = glm::scale(model, glm::vec3(size, 1.0f));
+	void SpriteRenderer::draw_sprite(Texture2D& texture, const glm::vec4& uv, glm::vec2 pos, glm::vec2 size, glm::vec3 color)
+	{
+		queue_(texture.id, GL_TEXTURE_2D, { glm::vec4(pos, size), uv, glm::vec4(color, 1), 0 });
+	}
 
-		shader.set("model", model);
-		shader.set("spriteColor", {1,1,1});
+	void SpriteRenderer::draw_sprite(Texture2DArray& texture, int slice, glm::vec2 pos, glm::vec2 size, glm::vec3 color)
+	{
+		queue_(texture.id, GL_TEXTURE_2D_ARRAY, { glm::vec4(pos, size), glm::vec4(0, 0, 1, 1), glm::vec4(color, 1), (float)slice });
+	}
+
+	void SpriteRenderer::queue_(GLuint texture, GLenum target, const SpriteInstance& instance) {
+		glm::vec2 pos(instance.rect), size(instance.rect.z, instance.rect.w);
+		if (culling && !intersects(cull_rect, glm::vec4(pos, pos + size))) return;
+
+		if (!batching) batch.clear();
+
+		float depth = y_sorted ? pos.y + size.y : 0.0f;
+		batch.push(texture, instance, layer, depth, target, order);
 
-		glActiveTexture(GL_TEXTURE0);
-		texture.bind();
+		if (!batching) flush();
+	}
+
+	void SpriteRenderer::draw_batch(const SpriteBatch& batch, const VBO& buffer) {
+		if (batch.groups.empty()) return;
+
+		buffer.bind();
+		submit_(batch, 0);
+	}
 
+	void SpriteRenderer::flush() {
+		batch.sort();
+		if (batch.groups.empty()) return;
+
+		GLintptr offset = instances.write(batch.instances.data(), batch.instances.size() * sizeof(SpriteInstance));
+		instances.bind();
+
+		submit_(batch, offset);
+		batch.clear();
+	}
+
+	void SpriteRenderer::submit_(const SpriteBatch& batch, GLintptr offset) {
+		shader.use();
 		vao.bind();
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		vao.unbind();
+
+		GLsizei stride = sizeof(SpriteInstance);
+		for (auto&& group : batch.groups) {
+			bool array = group.target == GL_TEXTURE_2D_ARRAY;
+			if (array != array_bound_) {
+				shader.set(array_, (int)array);
+				array_bound_ = array;
+			}
+
+			state_cache().active_texture(array ? GL_TEXTURE1 : GL_TEXTURE0);
+			state_cache().bind_texture(group.target, group.texture);
+
+			std::size_t base = offset + group.first * sizeof(SpriteInstance);
+			glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(base + offsetof(SpriteInstance, rect)));
+			glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(base + offsetof(SpriteInstance, uv)));
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(base + offsetof(SpriteInstance, color)));
+			glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, stride, (GLvoid*)(base + offsetof(SpriteInstance, slice)));
+
+			glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, nullptr, (GLsizei)group.count);
+		}
+		state_cache().active_texture(GL_TEXTURE0);
+
+		stats += batch.cost();
 	}
 
-	void Batch::clear() {
+	template <typename V>
+	void BasicBatch<V>::clear() {
 		vertices.clear();
+		quad_vertices.clear();
+		runs_.clear();
+	}
+
+	// [0, 1] -> [0, max], rounded
+	static GLuint pack_unorm(float x, float max) {
+		return (GLuint)(std::min(std::max(x, 0.0f), 1.0f) * max + 0.5f);
+	}
+
+	PackedVertex::PackedVertex(glm::vec3 position, glm::vec4 color, glm::vec2 tex_coord, GLfloat useTexture):
+		position(std::move(position)),
+		color(pack_unorm(color.r, 255) | pack_unorm(color.g, 255) << 8 | pack_unorm(color.b, 255) << 16 | pack_unorm(color.a, 255) << 24),
+		u((GLushort)(pack_unorm(tex_coord.x, 32767) | (useTexture != 0 ? texture_bit : 0))),
+		v((GLushort)pack_unorm(tex_coord.y, 65535)) {}
+
+	template <typename V>
+	void BasicBatch<V>::reserve(std::size_t triangle_vertices, std::size_t quads) {
+		vertices.reserve(triangle_vertices);
+		quad_vertices.reserve(quads * 4);
 	}
 
-	void Batch::push_back(Vertex v) {
-		vertices.push_back(std::move(v));
+	template <typename V>
+	V* BasicBatch<V>::write_quads(std::size_t count) {
+		std::size_t first = quad_vertices.size();
+		begin_run_(true, first);
+		quad_vertices.resize(first + count * 4);
+		return quad_vertices.data() + first;
 	}
 
-	void Batch::draw_arrays() {
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
-		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vertices.size());
+	template <typename V>
+	int BasicBatch<V>::draw(StreamBuffer& stream) {
+		sort_triangles();
+		sort_quads();
+
+		const std::size_t triangles = triangle_keys_.size(), quads = quad_keys_.size();
+
+		GLint first_triangle = 0, first_quad = 0;
+		if (triangles > 0) {
+			first_triangle = (GLint)(stream.write(vertices.data(), triangles * 3 * sizeof(V), sizeof(V)) / sizeof(V));
+		}
+		if (quads > 0) {
+			first_quad = (GLint)(stream.write(quad_vertices.data(), quads * 4 * sizeof(V), sizeof(V)) / sizeof(V));
+			quad_indices().bind();
+		}
+
+		// keys of the two lists never compare equal, their runs differ
+		int draws = 0;
+		std::size_t t = 0, q = 0;
+		while (t < triangles || q < quads) {
+			if (q == quads || (t < triangles && triangle_keys_[t].key < quad_keys_[q].key)) {
+				std::size_t begin = t;
+				while (t < triangles && (q == quads || triangle_keys_[t].key < quad_keys_[q].key)) t++;
+
+				glDrawArrays(GL_TRIANGLES, first_triangle + (GLint)(begin * 3), (GLsizei)((t - begin) * 3));
+				draws++;
+			} else {
+				std::size_t begin = q;
+				while (q < quads && (t == triangles || quad_keys_[q].key < triangle_keys_[t].key)) q++;
+
+				draws += quad_indices().draw(first_quad + (GLint)(begin * 4), (GLsizei)(q - begin));
+			}
+		}
+
+		return draws;
+	}
+
+	template <typename V>
+	void BasicBatch<V>::sort_triangles() {
+		sort_by_z_(vertices, sorted_triangles_, triangle_keys_, false);
+	}
+
+	template <typename V>
+	void BasicBatch<V>::sort_quads() {
+		sort_by_z_(quad_vertices, sorted_, quad_keys_, true);
+	}
+
+	template <typename V>
+	void BasicBatch<V>::sort_by_z_(std::vector<V>& list, std::vector<V>& sorted, std::vector<Key>& keys, bool quads) {
+		const std::size_t corners = quads ? 4 : 3;
+		const std::size_t count = list.size() / corners;
+
+		// the runs of this list in push order, by the vertex they start at
+		auto next_run = [&](std::size_t r) {
+			while (r < runs_.size() && runs_[r].quads != quads) r++;
+			return r;
+		};
+		std::size_t run = next_run(0);
+
+		keys.clear();
+		for (std::size_t i = 0; i < count; i++) {
+			for (std::size_t next = next_run(run + 1); next < runs_.size() && runs_[next].first <= i * corners;
+			     next = next_run(next + 1)) {
+				run = next;
+			}
+			std::uint64_t key = (std::uint64_t)float_sort_bits(list[i * corners].position.z) << 32 | run;
+			keys.push_back({ key, (std::uint32_t)i });
+		}
+
+		radix_sort(keys, key_scratch_, [](const Key& k) { return k.key; });
+
+		bool moved = false;
+		for (std::size_t i = 0; i < count && !moved; i++) {
+			moved = keys[i].index != i;
+		}
+		if (!moved) return;
+
+		// a trailing partial triangle stays where it is
+		sorted.resize(list.size());
+		for (std::size_t i = 0; i < count; i++) {
+			std::copy_n(&list[keys[i].index * corners], corners, &sorted[i * corners]);
+		}
+		std::copy(list.begin() + count * corners, list.end(), sorted.begin() + count * corners);
+		list.swap(sorted);
 	}
 
-	void Batch::push_triangle(v2 p1, v2 p2, v2 p3, float z, ColorTex ct) {
-		push_back({ v3(p1, z), ct.color, ct.tex, ct.useTexture });
-		push_back({ v3(p2, z), ct.color, ct.tex, ct.useTexture });
-		push_back({ v3(p3, z), ct.color, ct.tex, ct.useTexture });
+	template <typename V>
+	void BasicBatch<V>::push_triangle(v2 p1, v2 p2, v2 p3, float z, ColorTex ct) {
+		// the attributes are converted once, only the position changes
+		emplace_back(v3(p1, z), ct);
+		V v = vertices.back();
+		v.position = v3(p2, z);
+		push_back(v);
+		v.position = v3(p3, z);
+		push_back(v);
 	}
 
-	void Batch::push_quad(v2 p1, v2 p2, v2 p3, v2 p4, float z, ColorTex ct) {
-		push_triangle(p1, p2, p3, z, ct);
-		push_triangle(p1, p3, p4, z, ct);
+	template <typename V>
+	void BasicBatch<V>::push_quad(v2 p1, v2 p2, v2 p3, v2 p4, float z, ColorTex ct) {
+		V* corners = write_quads(1);
+		corners[0] = V(v3(p1, z), ct);
+		corners[1] = corners[0];
+		corners[1].position = v3(p2, z);
+		corners[2] = corners[0];
+		corners[2].position = v3(p3, z);
+		corners[3] = corners[0];
+		corners[3].position = v3(p4, z);
 	}
 
-	void Batch::push_quad(v2 center, float width, float height, float z, ColorTex ct) {
+	template <typename V>
+	void BasicBatch<V>::push_quad(v2 center, float width, float height, float z, ColorTex ct) {
 		push_quad(
 			{center.x - width / 2, center.y - height / 2},
 			{center.x + width / 2, center.y - height / 2},
@@ -292,7 +1077,8 @@ namespace gl
 		);
 	}
 
-	void Batch::push_quad_bot_left(v2 bot_left, float width, float height, float z, ColorTex ct) {
+	template <typename V>
+	void BasicBatch<V>::push_quad_bot_left(v2 bot_left, float width, float height, float z, ColorTex ct) {
 		push_quad(bot_left,
 		          {bot_left.x + width, bot_left.y},
 		          {bot_left.x + width, bot_left.y + height},
@@ -305,39 +1091,40 @@ namespace gl
 		return static_cast<float>(M_PI) / 180 * angle_deg;
 	}
 
-	void Batch::push_hex(glm::vec2 position, glm::vec3 color, float r) {
+	template <typename V>
+	void BasicBatch<V>::push_hex(glm::vec2 position, glm::vec3 color, float r) {
 		push_hex(glm::vec3(position, 0), glm::vec4(color, 1), r);
 	}
 
-	void Batch::push_hex(glm::vec2 position, glm::vec4 color, float r) {
+	template <typename V>
+	void BasicBatch<V>::push_hex(glm::vec2 position, glm::vec4 color, float r) {
 		push_hex(glm::vec3(position, 0), color, r);
 	}
 
-	void Batch::push_hex(glm::vec3 position, glm::vec4 color, float r) {
+	template <typename V>
+	void BasicBatch<V>::push_hex(glm::vec3 position, glm::vec4 color, float r) {
 		float ri;
 		int rot = 0; // 1;
 
 		glm::vec3 c = { color.x, color.y, color.z };
 
 		for (int i = rot; i < 6 + rot; i++) {
-			push_back({ position, {c.x, c.y, c.z, color.w} });
+			emplace_back(position, ColorTex(c.x, c.y, c.z, color.w));
 			ri = rad_for_hex(i - 1);
 			c += 0.015f;
 
-			push_back({
-				{position.x + r * cos(ri), position.y + r * sin(ri), position.z},
-				{c.x, c.y, c.z, color.w}
-			});
+			emplace_back(v3(position.x + r * cos(ri), position.y + r * sin(ri), position.z),
+			             ColorTex(c.x, c.y, c.z, color.w));
 
 			ri = rad_for_hex(i);
 			c += 0.015f;
 
-			push_back({
-				{position.x + r * cos(ri), position.y + r * sin(ri), position.z},
-				{c.x, c.y, c.z, color.w}
-			});
+			emplace_back(v3(position.x + r * cos(ri), position.y + r * sin(ri), position.z),
+			             ColorTex(c.x, c.y, c.z, color.w));
 		}
 	}
 
+	template class BasicBatch<Vertex>;
+	template class BasicBatch<PackedVertex>;
 }
 
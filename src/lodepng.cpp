@@ -33,6 +33,12 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LODEPNG_SSE2
+#include <emmintrin.h>
+#endif
 
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
@@ -513,6 +519,10 @@ typedef struct HuffmanTree
   unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
   unsigned maxbitlen; /*maximum number of bits a single code can get*/
   unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+  /*lookup tables of the fast decoder, see HuffmanTree_makeTable*/
+  unsigned char* table_len;
+  unsigned short* table_value;
+  unsigned* table_pair;
 } HuffmanTree;
 
 /*function used for debug purposes to draw the tree in ascii art with C++*/
@@ -533,6 +543,9 @@ static void HuffmanTree_init(HuffmanTree* tree)
   tree->tree2d = 0;
   tree->tree1d = 0;
   tree->lengths = 0;
+  tree->table_len = 0;
+  tree->table_value = 0;
+  tree->table_pair = 0;
 }
 
 static void HuffmanTree_cleanup(HuffmanTree* tree)
@@ -540,6 +553,9 @@ static void HuffmanTree_cleanup(HuffmanTree* tree)
   lodepng_free(tree->tree2d);
   lodepng_free(tree->tree1d);
   lodepng_free(tree->lengths);
+  lodepng_free(tree->table_len);
+  lodepng_free(tree->table_value);
+  lodepng_free(tree->table_pair);
 }
 
 /*the tree representation used by the decoder. return value is error*/
@@ -629,6 +645,8 @@ static unsigned HuffmanTree_makeFromLengths2(HuffmanTree* tree)
   {
     /*step 1: count number of instances of each code length*/
     for(bits = 0; bits != tree->numcodes; ++bits) ++blcount.data[tree->lengths[bits]];
+    /*unused symbols take no code space, otherwise codes get bits above their length*/
+    blcount.data[0] = 0;
     /*step 2: generate the nextcode values*/
     for(bits = 1; bits <= tree->maxbitlen; ++bits)
     {
@@ -946,6 +964,171 @@ static unsigned huffmanDecodeSymbol(const unsigned char* in, size_t* bp,
     if(treepos >= codetree->numcodes) return (unsigned)(-1); /*error: it appeared outside the codetree*/
   }
 }
+/*
+Table driven decoding, used instead of huffmanDecodeSymbol unless fast_inflate
+is off. The next HUFFMAN_ROOT_BITS bits of the stream index the root table:
+codes up to that length are found directly (every entry whose low bits are the
+bit-reversed code holds the symbol and its length), longer codes point to a
+second level table indexed by the bits after the root bits. Unused entries
+have length HUFFMAN_INVALID_LEN.
+table_pair, only built for the literal/length tree, holds two literals whose
+codes fit into the root bits together: lit1 | lit2 << 8 | bits << 16, or 0.
+*/
+#define HUFFMAN_ROOT_BITS 10u
+#define HUFFMAN_ROOT_MASK ((1u << HUFFMAN_ROOT_BITS) - 1u)
+#define HUFFMAN_INVALID_LEN 16u
+
+static unsigned reverseBits(unsigned bits, unsigned num)
+{
+  unsigned i, result = 0;
+  for(i = 0; i < num; ++i) result |= ((bits >> (num - i - 1u)) & 1u) << i;
+  return result;
+}
+
+/*tree1d and lengths must be filled in, return value is error*/
+static unsigned HuffmanTree_makeTable(HuffmanTree* tree, unsigned pairs)
+{
+  static const unsigned headsize = 1u << HUFFMAN_ROOT_BITS;
+  unsigned maxlens[1u << HUFFMAN_ROOT_BITS];
+  size_t size, pointer;
+  unsigned i, j;
+
+  for(i = 0; i < headsize; ++i) maxlens[i] = 0;
+  for(i = 0; i < tree->numcodes; ++i)
+  {
+    unsigned l = tree->lengths[i];
+    unsigned index;
+    if(l <= HUFFMAN_ROOT_BITS) continue;
+    index = reverseBits(tree->tree1d[i], l) & HUFFMAN_ROOT_MASK;
+    if(l > maxlens[index]) maxlens[index] = l;
+  }
+
+  size = headsize;
+  for(i = 0; i < headsize; ++i)
+  {
+    if(maxlens[i] > HUFFMAN_ROOT_BITS) size += (size_t)1u << (maxlens[i] - HUFFMAN_ROOT_BITS);
+  }
+
+  tree->table_len = (unsigned char*)lodepng_malloc(size * sizeof(*tree->table_len));
+  tree->table_value = (unsigned short*)lodepng_malloc(size * sizeof(*tree->table_value));
+  if(!tree->table_len || !tree->table_value) return 83; /*alloc fail*/
+  for(i = 0; i < size; ++i)
+  {
+    tree->table_len[i] = HUFFMAN_INVALID_LEN;
+    tree->table_value[i] = 0;
+  }
+
+  /*root entries of long codes: the length of their longest code and where their second level starts*/
+  pointer = headsize;
+  for(i = 0; i < headsize; ++i)
+  {
+    if(maxlens[i] <= HUFFMAN_ROOT_BITS) continue;
+    tree->table_len[i] = (unsigned char)maxlens[i];
+    tree->table_value[i] = (unsigned short)pointer;
+    pointer += (size_t)1u << (maxlens[i] - HUFFMAN_ROOT_BITS);
+  }
+
+  for(i = 0; i < tree->numcodes; ++i)
+  {
+    unsigned l = tree->lengths[i];
+    unsigned reversed;
+    if(l == 0) continue;
+    /*an oversubscribed code does not fit into l bits, make2DTree reports it*/
+    if(tree->tree1d[i] >> l) return 55;
+    reversed = reverseBits(tree->tree1d[i], l);
+
+    if(l <= HUFFMAN_ROOT_BITS)
+    {
+      unsigned num = 1u << (HUFFMAN_ROOT_BITS - l);
+      for(j = 0; j < num; ++j)
+      {
+        unsigned index = reversed | (j << l);
+        tree->table_len[index] = (unsigned char)l;
+        tree->table_value[index] = (unsigned short)i;
+      }
+    }
+    else
+    {
+      unsigned index = reversed & HUFFMAN_ROOT_MASK;
+      unsigned sublen, start, num;
+      /*a shorter code with the same prefix, not a prefix code*/
+      if(tree->table_len[index] <= HUFFMAN_ROOT_BITS || tree->table_len[index] == HUFFMAN_INVALID_LEN) return 55;
+      sublen = tree->table_len[index] - HUFFMAN_ROOT_BITS;
+      start = tree->table_value[index];
+      num = 1u << (sublen - (l - HUFFMAN_ROOT_BITS));
+      for(j = 0; j < num; ++j)
+      {
+        unsigned index2 = start + ((reversed >> HUFFMAN_ROOT_BITS) | (j << (l - HUFFMAN_ROOT_BITS)));
+        tree->table_len[index2] = (unsigned char)l;
+        tree->table_value[index2] = (unsigned short)i;
+      }
+    }
+  }
+
+  if(pairs)
+  {
+    tree->table_pair = (unsigned*)lodepng_malloc(headsize * sizeof(unsigned));
+    if(!tree->table_pair) return 83; /*alloc fail*/
+
+    for(i = 0; i < headsize; ++i)
+    {
+      unsigned l1 = tree->table_len[i], l2, rest;
+      tree->table_pair[i] = 0;
+      if(l1 >= HUFFMAN_ROOT_BITS || tree->table_value[i] > 255) continue;
+
+      /*the bits after the first code, only HUFFMAN_ROOT_BITS - l1 of them are known*/
+      rest = i >> l1;
+      l2 = tree->table_len[rest];
+      if(l2 > HUFFMAN_ROOT_BITS - l1 || tree->table_value[rest] > 255) continue;
+
+      tree->table_pair[i] = tree->table_value[i] | (unsigned)tree->table_value[rest] << 8 | (l1 + l2) << 16;
+    }
+  }
+
+  return 0;
+}
+
+/*
+The next 25 bits of the stream starting at bit bp, bits past the end read as 0.
+The caller checks that the bit pointer did not move past the end.
+*/
+static unsigned peekBits(const unsigned char* in, size_t bp, size_t inlength)
+{
+  size_t p = bp >> 3;
+  unsigned result = 0;
+  if(p + 4 <= inlength)
+  {
+    result = in[p] | ((unsigned)in[p + 1] << 8) | ((unsigned)in[p + 2] << 16) | ((unsigned)in[p + 3] << 24);
+  }
+  else
+  {
+    unsigned i;
+    for(i = 0; p + i < inlength; ++i) result |= (unsigned)in[p + i] << (8 * i);
+  }
+  return result >> (bp & 7u);
+}
+
+/*decodes the symbol at the start of bits (from peekBits), returns (unsigned)(-1) for an invalid code*/
+static unsigned huffmanDecodeSymbolFast(const HuffmanTree* codetree, unsigned bits, size_t* bp)
+{
+  unsigned index = bits & HUFFMAN_ROOT_MASK;
+  unsigned len = codetree->table_len[index];
+  unsigned value = codetree->table_value[index];
+
+  if(len <= HUFFMAN_ROOT_BITS)
+  {
+    *bp += len;
+    return value;
+  }
+  if(len == HUFFMAN_INVALID_LEN) return (unsigned)(-1);
+
+  index = value + ((bits >> HUFFMAN_ROOT_BITS) & ((1u << (len - HUFFMAN_ROOT_BITS)) - 1u));
+  len = codetree->table_len[index];
+  if(len == HUFFMAN_INVALID_LEN) return (unsigned)(-1);
+
+  *bp += len;
+  return codetree->table_value[index];
+}
 #endif /*LODEPNG_COMPILE_DECODER*/
 
 #ifdef LODEPNG_COMPILE_DECODER
@@ -1205,6 +1388,117 @@ static unsigned inflateHuffmanBlock(ucvector* out, const unsigned char* in, size
   return error;
 }
 
+/*
+inflateHuffmanBlock with the lookup tables of HuffmanTree_makeTable: a symbol
+costs one or two table reads instead of one tree step per bit, and two short
+literals are often decoded by a single read of table_pair.
+*/
+static unsigned inflateHuffmanBlockFast(ucvector* out, const unsigned char* in, size_t* bp,
+                                        size_t* pos, size_t inlength, unsigned btype)
+{
+  unsigned error = 0;
+  HuffmanTree tree_ll; /*the huffman tree for literal and length codes*/
+  HuffmanTree tree_d; /*the huffman tree for distance codes*/
+  size_t inbitlength = inlength * 8;
+
+  HuffmanTree_init(&tree_ll);
+  HuffmanTree_init(&tree_d);
+
+  if(btype == 1) getTreeInflateFixed(&tree_ll, &tree_d);
+  else if(btype == 2) error = getTreeInflateDynamic(&tree_ll, &tree_d, in, bp, inlength);
+
+  if(!error) error = HuffmanTree_makeTable(&tree_ll, 1);
+  if(!error) error = HuffmanTree_makeTable(&tree_d, 0);
+
+  while(!error) /*decode all symbols until end reached, breaks at end code*/
+  {
+    unsigned bits = peekBits(in, *bp, inlength);
+    unsigned pair = tree_ll.table_pair[bits & HUFFMAN_ROOT_MASK];
+    unsigned code_ll;
+
+    if(pair)
+    {
+      *bp += pair >> 16;
+      if(*bp > inbitlength) ERROR_BREAK(10); /*error: end of input memory reached without endcode*/
+      if(!ucvector_resize(out, (*pos) + 2)) ERROR_BREAK(83 /*alloc fail*/);
+      out->data[(*pos)++] = (unsigned char)pair;
+      out->data[(*pos)++] = (unsigned char)(pair >> 8);
+      continue;
+    }
+
+    code_ll = huffmanDecodeSymbolFast(&tree_ll, bits, bp);
+    if(code_ll == (unsigned)(-1)) ERROR_BREAK(11); /*error: the code is not in the tree*/
+    if(*bp > inbitlength) ERROR_BREAK(10); /*error: end of input memory reached without endcode*/
+
+    if(code_ll <= 255) /*literal symbol*/
+    {
+      if(!ucvector_resize(out, (*pos) + 1)) ERROR_BREAK(83 /*alloc fail*/);
+      out->data[(*pos)++] = (unsigned char)code_ll;
+    }
+    else if(code_ll >= FIRST_LENGTH_CODE_INDEX && code_ll <= LAST_LENGTH_CODE_INDEX) /*length code*/
+    {
+      unsigned code_d, distance;
+      unsigned numextrabits_l, numextrabits_d; /*extra bits for length and distance*/
+      size_t backward, length;
+
+      length = LENGTHBASE[code_ll - FIRST_LENGTH_CODE_INDEX];
+      numextrabits_l = LENGTHEXTRA[code_ll - FIRST_LENGTH_CODE_INDEX];
+      if(numextrabits_l)
+      {
+        if((*bp + numextrabits_l) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+        length += peekBits(in, *bp, inlength) & ((1u << numextrabits_l) - 1u);
+        *bp += numextrabits_l;
+      }
+
+      code_d = huffmanDecodeSymbolFast(&tree_d, peekBits(in, *bp, inlength), bp);
+      if(code_d == (unsigned)(-1)) ERROR_BREAK(11);
+      if(*bp > inbitlength) ERROR_BREAK(10);
+      if(code_d > 29) ERROR_BREAK(18); /*error: invalid distance code (30-31 are never used)*/
+
+      distance = DISTANCEBASE[code_d];
+      numextrabits_d = DISTANCEEXTRA[code_d];
+      if(numextrabits_d)
+      {
+        if((*bp + numextrabits_d) > inbitlength) ERROR_BREAK(51); /*error, bit pointer will jump past memory*/
+        distance += peekBits(in, *bp, inlength) & ((1u << numextrabits_d) - 1u);
+        *bp += numextrabits_d;
+      }
+
+      if(distance > *pos) ERROR_BREAK(52); /*too long backward distance*/
+      backward = *pos - distance;
+
+      if(!ucvector_resize(out, (*pos) + length)) ERROR_BREAK(83 /*alloc fail*/);
+      if(distance >= length)
+      {
+        memcpy(out->data + *pos, out->data + backward, length);
+      }
+      else if(distance == 1)
+      {
+        memset(out->data + *pos, out->data[backward], length);
+      }
+      else
+      {
+        /*overlapping: the run repeats every distance bytes*/
+        unsigned char* dst = out->data + *pos;
+        const unsigned char* src = out->data + backward;
+        size_t i;
+        for(i = 0; i < length; ++i) dst[i] = src[i];
+      }
+      *pos += length;
+    }
+    else if(code_ll == 256)
+    {
+      break; /*end code, break the loop*/
+    }
+    else ERROR_BREAK(11); /*length codes 286 and 287 are never used*/
+  }
+
+  HuffmanTree_cleanup(&tree_ll);
+  HuffmanTree_cleanup(&tree_d);
+
+  return error;
+}
+
 static unsigned inflateNoCompression(ucvector* out, const unsigned char* in, size_t* bp, size_t* pos, size_t inlength)
 {
   size_t p;
@@ -1243,8 +1537,6 @@ static unsigned lodepng_inflatev(ucvector* out,
   size_t pos = 0; /*byte position in the out buffer*/
   unsigned error = 0;
 
-  (void)settings;
-
   while(!BFINAL)
   {
     unsigned BTYPE;
@@ -1255,6 +1547,7 @@ static unsigned lodepng_inflatev(ucvector* out,
 
     if(BTYPE == 3) return 20; /*error: invalid BTYPE*/
     else if(BTYPE == 0) error = inflateNoCompression(out, in, &bp, &pos, insize); /*no compression*/
+    else if(settings->fast_inflate) error = inflateHuffmanBlockFast(out, in, &bp, &pos, insize, BTYPE);
     else error = inflateHuffmanBlock(out, in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
 
     if(error) return error;
@@ -2282,9 +2575,11 @@ void lodepng_decompress_settings_init(LodePNGDecompressSettings* settings)
   settings->custom_zlib = 0;
   settings->custom_inflate = 0;
   settings->custom_context = 0;
+
+  settings->fast_inflate = 1;
 }
 
-const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0};
+const LodePNGDecompressSettings lodepng_default_decompress_settings = {0, 0, 0, 0, 1};
 
 #endif /*LODEPNG_COMPILE_DECODER*/
 
@@ -4016,7 +4311,115 @@ static unsigned unfilterScanline(unsigned char* recon, const unsigned char* scan
   return 0;
 }
 
-static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp)
+#ifdef LODEPNG_SSE2
+/*one pixel of 3 or 4 bytes in the low lanes of a register*/
+static __m128i loadPixel(const unsigned char* p, size_t bytewidth)
+{
+  int value = 0;
+  /*constant sizes, so the copies compile to plain loads and stores*/
+  if(bytewidth == 4) memcpy(&value, p, 4);
+  else memcpy(&value, p, 3);
+  return _mm_cvtsi32_si128(value);
+}
+
+static void storePixel(unsigned char* p, __m128i pixel, size_t bytewidth)
+{
+  int value = _mm_cvtsi128_si32(pixel);
+  if(bytewidth == 4) memcpy(p, &value, 4);
+  else memcpy(p, &value, 3);
+}
+
+/*
+SSE2 version of unfilterScanline for the common cases, returns 0 when it does
+not handle the scanline. Up works on 16 bytes at a time; Sub, Average and Paeth
+depend on the pixel to the left, so for 3 and 4 byte pixels all channels of a
+pixel are done at once. The results are the same as unfilterScanline's.
+*/
+static int unfilterScanlineSSE2(unsigned char* recon, const unsigned char* scanline, const unsigned char* precon,
+                                size_t bytewidth, unsigned char filterType, size_t length)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+
+  if(filterType == 2 && precon)
+  {
+    for(; i + 16 <= length; i += 16)
+    {
+      __m128i x = _mm_loadu_si128((const __m128i*)(scanline + i));
+      __m128i b = _mm_loadu_si128((const __m128i*)(precon + i));
+      _mm_storeu_si128((__m128i*)(recon + i), _mm_add_epi8(x, b));
+    }
+    for(; i != length; ++i) recon[i] = scanline[i] + precon[i];
+    return 1;
+  }
+
+  if(bytewidth != 3 && bytewidth != 4) return 0;
+
+  if(filterType == 1)
+  {
+    __m128i a = zero;
+    for(; i < length; i += bytewidth)
+    {
+      a = _mm_add_epi8(a, loadPixel(scanline + i, bytewidth));
+      storePixel(recon + i, a, bytewidth);
+    }
+    return 1;
+  }
+
+  if(!precon) return 0;
+
+  if(filterType == 3)
+  {
+    const __m128i one = _mm_set1_epi8(1);
+    __m128i a = zero;
+    for(; i < length; i += bytewidth)
+    {
+      __m128i b = loadPixel(precon + i, bytewidth);
+      /*_mm_avg_epu8 rounds up, (a + b) >> 1 rounds down*/
+      __m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+      a = _mm_add_epi8(loadPixel(scanline + i, bytewidth), average);
+      storePixel(recon + i, a, bytewidth);
+    }
+    return 1;
+  }
+
+  if(filterType == 4)
+  {
+    /*16-bit lanes: a left, b above, c above left, as in paethPredictor*/
+    __m128i a = zero, c = zero;
+    for(; i < length; i += bytewidth)
+    {
+      __m128i b = _mm_unpacklo_epi8(loadPixel(precon + i, bytewidth), zero);
+      __m128i pa = _mm_sub_epi16(b, c);
+      __m128i pb = _mm_sub_epi16(a, c);
+      __m128i pc = _mm_add_epi16(pa, pb);
+      __m128i smallest, nearest, pick_a, pick_b;
+
+      pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+      pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+      pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+      smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+
+      /*a wins ties, then b*/
+      pick_a = _mm_cmpeq_epi16(smallest, pa);
+      pick_b = _mm_andnot_si128(pick_a, _mm_cmpeq_epi16(smallest, pb));
+      nearest = _mm_or_si128(_mm_and_si128(pick_a, a), _mm_and_si128(pick_b, b));
+      nearest = _mm_or_si128(nearest, _mm_andnot_si128(_mm_or_si128(pick_a, pick_b), c));
+
+      /*bytewise add keeps the sum modulo 256 in the low byte of each lane*/
+      a = _mm_add_epi8(_mm_unpacklo_epi8(loadPixel(scanline + i, bytewidth), zero), nearest);
+      storePixel(recon + i, _mm_packus_epi16(a, a), bytewidth);
+      c = b;
+    }
+    return 1;
+  }
+
+  return 0;
+}
+#endif /*LODEPNG_SSE2*/
+
+static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w, unsigned h, unsigned bpp,
+                         unsigned fast)
 {
   /*
   For PNG filter method 0
@@ -4028,6 +4431,7 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
 
   unsigned y;
   unsigned char* prevline = 0;
+  (void)fast; /*only the SSE2 path has a faster unfilter*/
 
   /*bytewidth is used for filtering, is 1 when bpp < 8, number of bytes per pixel otherwise*/
   size_t bytewidth = (bpp + 7) / 8;
@@ -4039,6 +4443,9 @@ static unsigned unfilter(unsigned char* out, const unsigned char* in, unsigned w
     size_t inindex = (1 + linebytes) * y; /*the extra filterbyte added to each row*/
     unsigned char filterType = in[inindex];
 
+#ifdef LODEPNG_SSE2
+    if(!fast || !unfilterScanlineSSE2(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes))
+#endif /*LODEPNG_SSE2*/
     CERROR_TRY_RETURN(unfilterScanline(&out[outindex], &in[inindex + 1], prevline, bytewidth, filterType, linebytes));
 
     prevline = &out[outindex];
@@ -4139,7 +4546,7 @@ static void removePaddingBits(unsigned char* out, const unsigned char* in,
 the IDAT chunks (with filter index bytes and possible padding bits)
 return value is error*/
 static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
-                                     unsigned w, unsigned h, const LodePNGInfo* info_png)
+                                     unsigned w, unsigned h, const LodePNGInfo* info_png, unsigned fast)
 {
   /*
   This function converts the filtered-padded-interlaced data into pure 2D image buffer with the PNG's colortype.
@@ -4155,11 +4562,11 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
   {
     if(bpp < 8 && w * bpp != ((w * bpp + 7) / 8) * 8)
     {
-      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp));
+      CERROR_TRY_RETURN(unfilter(in, in, w, h, bpp, fast));
       removePaddingBits(out, in, w * bpp, ((w * bpp + 7) / 8) * 8, h);
     }
     /*we can immediately filter into the out buffer, no other steps needed*/
-    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp));
+    else CERROR_TRY_RETURN(unfilter(out, in, w, h, bpp, fast));
   }
   else /*interlace_method is 1 (Adam7)*/
   {
@@ -4170,7 +4577,7 @@ static unsigned postProcessScanlines(unsigned char* out, unsigned char* in,
 
     for(i = 0; i != 7; ++i)
     {
-      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp));
+      CERROR_TRY_RETURN(unfilter(&in[padded_passstart[i]], &in[filter_passstart[i]], passw[i], passh[i], bpp, fast));
       /*TODO: possible efficiency improvement: if in this reduced image the bits fit nicely in 1 scanline,
       move bytes instead of bits or move not at all*/
       if(bpp < 8)
@@ -4501,7 +4908,6 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
 {
   unsigned char IEND = 0;
   const unsigned char* chunk;
-  size_t i;
   ucvector idat; /*the data from idat chunks*/
   ucvector scanlines;
   size_t predict;
@@ -4558,7 +4964,7 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
     {
       size_t oldsize = idat.size;
       if(!ucvector_resize(&idat, oldsize + chunkLength)) CERROR_BREAK(state->error, 83 /*alloc fail*/);
-      for(i = 0; i != chunkLength; ++i) idat.data[oldsize + i] = data[i];
+      if(chunkLength) memcpy(idat.data + oldsize, data, chunkLength);
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
       critical_pos = 3;
 #endif /*LODEPNG_COMPILE_ANCILLARY_CHUNKS*/
@@ -4690,8 +5096,10 @@ static void decodeGeneric(unsigned char** out, unsigned* w, unsigned* h,
   }
   if(!state->error)
   {
-    for(i = 0; i < outsize; i++) (*out)[i] = 0;
-    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png);
+    /*only the bit packing of bpp < 8 relies on a zeroed buffer, wider pixels are all written*/
+    if(lodepng_get_bpp(&state->info_png.color) < 8) memset(*out, 0, outsize);
+    state->error = postProcessScanlines(*out, scanlines.data, *w, *h, &state->info_png,
+                                        state->decoder.fast_unfilter);
   }
   ucvector_cleanup(&scanlines);
 }
@@ -4791,6 +5199,7 @@ unsigned lodepng_decode24_file(unsigned char** out, unsigned* w, unsigned* h, co
 void lodepng_decoder_settings_init(LodePNGDecoderSettings* settings)
 {
   settings->color_convert = 1;
+  settings->fast_unfilter = 1;
 #ifdef LODEPNG_COMPILE_ANCILLARY_CHUNKS
   settings->read_text_chunks = 1;
   settings->remember_unknown_chunks = 0;
@@ -29,6 +29,8 @@
 
 //#include "tiled.hpp"
 #include <gl_utils.hpp>
+#include <scene.hpp>
+#include <profiler.hpp>
 
 // Window dimensions
 const GLuint WIDTH = 800, HEIGHT = 600;
@@ -58,7 +60,7 @@ void tile_at(std::vector<float>& vbo_data, float x, float y, float size) {
 	float off = size / 2;
 
 	// Position      Color             Texture coords
-	std::vector<float> vertices{
+	const float vertices[] = {
 		x + off, y + off, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f,
 		x + off, y - off, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f,
 		x - off, y - off, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f,
@@ -68,19 +70,14 @@ void tile_at(std::vector<float>& vbo_data, float x, float y, float size) {
 		x - off, y + off, 1.0f, 1.0f, 1.0,  0.0f, 0.0f,
 	};
 
-	for (float v : vertices) {
-		vbo_data.push_back(v);
-	}
+	vbo_data.insert(vbo_data.end(), std::begin(vertices), std::end(vertices));
 }
 
-int current_x = 0;
-int current_y = 0;
-
-void draw_vector_triangles(const std::vector<float>& vbo_data) {
-	// sending vertices to the graphic cards and making it active
-	glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vbo_data.size(),
-		vbo_data.data(), GL_STATIC_DRAW);
-	glDrawArrays(GL_TRIANGLES, 0, vbo_data.size());
+void draw_vector_triangles(gl::StreamBuffer& stream, const std::vector<float>& vbo_data) {
+	// appending vertices to the stream buffer, 7 floats per vertex (see tile_at)
+	const GLsizeiptr stride = 7 * sizeof(float);
+	GLintptr offset = stream.write(vbo_data.data(), sizeof(float) * vbo_data.size(), stride);
+	glDrawArrays(GL_TRIANGLES, (GLint)(offset / stride), (GLsizei)(vbo_data.size() / 7));
 }
 
 void game_loop(SDL_Window* window) {
@@ -92,42 +89,16 @@ void game_loop(SDL_Window* window) {
 	// Setup ImGui binding
 	ImGui_ImplSdlGL3_Init(window);
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-	glViewport(0, 0, WIDTH, HEIGHT);
-
 	VAO vao;
 	VBO vbo;
 
 
 	SDL_Event event;
 
-	Shader spriteShader("res/sprite");
-	SpriteRenderer sprite(spriteShader);
-
-	spriteShader.set("projection", ortho(0.0f, (float)WIDTH, (float)HEIGHT, 0.0f, -1.0f, 1.0f));
-
-	auto map = load_tiles("xmlova.tmx");
-
-
-	std::unordered_map<int, Texture2D> textures;
-
-	for (size_t i = 0; i < map.tiles.size(); i++)
-	{
-		Texture2D t;
-		t.image_format = GL_RGBA;
-		t.internal_format = GL_RGBA;
-		t.load_png("res/" + map.tiles[i].filename);
-
-		textures[map.tiles[i].gid] = std::move(t);
-	}
-
-	Texture2D t1;
-	t1.image_format = GL_RGBA;
-	t1.internal_format = GL_RGBA;
-	t1.load_png("res/kuratko_basic_klaciky.png");
+	Scene scene("xmlova", WIDTH, HEIGHT);
 
+	// two frames at 60 Hz, spike_<frame>.json gets the 120 frames around it
+	PROFILE_SPIKE_BUDGET(33.3f, 120);
 
 	while (true) {
 		ImGui_ImplSdlGL3_NewFrame(window);
@@ -140,37 +111,23 @@ void game_loop(SDL_Window* window) {
 
 			if (event.type == SDL_KEYDOWN) {
 				switch (event.key.keysym.sym) {
-				case 'w': current_y--; break;
-				case 's': current_y++; break;
-				case 'a': current_x--; break;
-				case 'd': current_x++; break;
+				case 'w': scene.player_y--; break;
+				case 's': scene.player_y++; break;
+				case 'a': scene.player_x--; break;
+				case 'd': scene.player_x++; break;
+				case SDLK_F8: scene.tilemap_shader = !scene.tilemap_shader; break;
+				case SDLK_F9: PROFILE_WRITE_TRACE("trace.json", 300); break;
 				}
 			}
 
-			ImGui_ImplSdlGL3_ProcessEvent(&event);
-		}
-
-		glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT);
-
-		int tile_size = 32;
-
-
-
-		for (size_t i = 0; i < map.N(); i++)
-		{
-			for (size_t j = 0; j < map.N(); j++)
-			{
-				auto id = map.gid(i, j) - 1;
-				if (textures.count(id) > 0) {
-					auto&& tex = textures[id];
-					sprite.draw_sprite(tex, vec2(j * tile_size, i * tile_size));
-				}
+			if (event.type == SDL_MOUSEWHEEL) {
+				scene.camera.scroll(event.wheel.y);
 			}
 
+			ImGui_ImplSdlGL3_ProcessEvent(&event);
 		}
 
-		sprite.draw_sprite(t1, vec2(current_x * tile_size, current_y * tile_size));
+		scene.draw();
 
 		if (storyProgress == 0) {
 			ImGui::Begin("Kuratko Nufik - Kapitola 1");
@@ -192,11 +149,21 @@ void game_loop(SDL_Window* window) {
 		else if (storyProgress == 1) {
 		}
 
-		
+		PROFILE_OVERLAY();
+
+		{
+			PROFILE_GPU_ZONE("imgui");
+			ImGui::Render();
+		}
+		// ImGui binds its own program, buffers and textures
+		state_cache().invalidate();
 
-		ImGui::Render();
+		{
+			PROFILE_ZONE("swap");
+			SDL_GL_SwapWindow(window);
+		}
 
-		SDL_GL_SwapWindow(window);
+		PROFILE_FRAME();
 	}
 }
 
@@ -212,6 +179,7 @@ int main(int, char**) {
 		std::cout << "Failed to initialize OpenGL context" << std::endl;
 		return 1;
 	}
+	gl::load_extensions((GLADloadproc)SDL_GL_GetProcAddress);
 
 	game_loop(window);
 
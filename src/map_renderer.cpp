@@ -0,0 +1,166 @@
+#include <algorithm>
+
+#include <map_renderer.hpp>
+
+namespace gl
+{
+	MapRenderer::MapRenderer(SpriteRenderer& sprites, TileMap& map, TextureAtlas& atlas):
+		sprites(sprites), map(map), atlas(atlas), y_sorted_(map.layers.size(), false), hidden_(map.layers.size(), false) {
+
+		for (std::size_t l = 0; l < map.layers.size(); l++) {
+			auto&& layer = map.layers[l];
+			layer_chunks_.push_back(chunks_.size());
+
+			for (int y = 0; y < layer.chunks_y(); y++) {
+				for (int x = 0; x < layer.chunks_x(); x++) {
+					std::unique_ptr<Chunk> chunk(new Chunk());
+					chunk->layer = l;
+					chunk->x = x;
+					chunk->y = y;
+
+					chunks_.push_back(std::move(chunk));
+				}
+			}
+		}
+	}
+
+	void MapRenderer::build_(Chunk& chunk) {
+		auto&& layer = map.layers[chunk.layer];
+		const int n = TileLayer::chunk_size;
+
+		int i_end = std::min((chunk.y + 1) * n, layer.height);
+		int j_end = std::min((chunk.x + 1) * n, layer.width);
+
+		glm::vec2 size(map.tile_width, map.tile_height);
+
+		chunk.batch.clear();
+		chunk.incomplete = false;
+		for (int i = chunk.y * n; i < i_end; i++) {
+			for (int j = chunk.x * n; j < j_end; j++) {
+				// tileset ids start at firstgid 1
+				int gid = layer.gid(i, j);
+				auto region = atlas.find(gid - 1);
+				if (!region) {
+					if (gid && on_missing) on_missing(gid - 1);
+					chunk.incomplete = chunk.incomplete || gid;
+					continue;
+				}
+
+				glm::vec2 pos(j * size.x, i * size.y);
+				SpriteInstance instance{ glm::vec4(pos, size), region->uv, glm::vec4(1), (float)region->slice };
+				if (region->page < 0) chunk.batch.push(atlas.tiles.id, instance, 0, 0, GL_TEXTURE_2D_ARRAY);
+				else chunk.batch.push(atlas.page(*region).id, instance);
+			}
+		}
+		chunk.batch.sort();
+
+		chunk.instances.bind();
+		glBufferData(GL_ARRAY_BUFFER, chunk.batch.instances.size() * sizeof(SpriteInstance),
+		             chunk.batch.instances.data(), GL_STATIC_DRAW);
+
+		chunk.revision = layer.revision(chunk.x, chunk.y);
+		chunk.atlas_revision = atlas.revision;
+		chunk.tiles_id = atlas.tiles.id;
+		rebuilt++;
+	}
+
+	void MapRenderer::draw_(Chunk& chunk) {
+		if (chunk.revision != map.layers[chunk.layer].revision(chunk.x, chunk.y)
+			|| (chunk.incomplete && chunk.atlas_revision != atlas.revision)
+			|| chunk.tiles_id != atlas.tiles.id) {
+			build_(chunk);
+		}
+
+		sprites.draw_batch(chunk.batch, chunk.instances);
+		drawn++;
+	}
+
+	void MapRenderer::queue_(std::size_t layer, const CellRange& range) {
+		glm::vec2 size(map.tile_width, map.tile_height);
+
+		// cells of the same row keep the map order
+		sprites.set_layer(sort_layer, true, (std::uint8_t)std::min<std::size_t>(layer, 254));
+		map.for_each_cell(layer, range, [&](int i, int j, int gid) {
+			auto region = atlas.find(gid - 1);
+			if (!region) {
+				if (gid && on_missing) on_missing(gid - 1);
+				return;
+			}
+
+			glm::vec2 pos(j * size.x, i * size.y);
+			if (region->page < 0) sprites.draw_sprite(atlas.tiles, region->slice, pos, size);
+			else sprites.draw_sprite(atlas.page(*region), region->uv, pos, size);
+		});
+	}
+
+	void MapRenderer::set_y_sorted(std::size_t layer, bool y_sorted) {
+		y_sorted_[layer] = y_sorted;
+	}
+
+	std::uint8_t MapRenderer::sprite_order() const {
+		return (std::uint8_t)std::min<std::size_t>(map.layers.size(), 255);
+	}
+
+	void MapRenderer::set_hidden(std::size_t layer, bool hidden) {
+		hidden_[layer] = hidden;
+	}
+
+	void MapRenderer::draw() {
+		drawn = rebuilt = 0;
+
+		bool queued = false;
+		for (std::size_t l = 0; l < map.layers.size(); l++) {
+			if (hidden_[l]) continue;
+
+			if (y_sorted_[l]) {
+				CellRange all;
+				all.row_end = map.layers[l].height;
+				all.col_end = map.layers[l].width;
+				queue_(l, all);
+				queued = true;
+				continue;
+			}
+
+			if (queued) flush_();
+			queued = false;
+
+			std::size_t end = l + 1 < layer_chunks_.size() ? layer_chunks_[l + 1] : chunks_.size();
+			for (std::size_t c = layer_chunks_[l]; c < end; c++) draw_(*chunks_[c]);
+		}
+	}
+
+	void MapRenderer::draw(const glm::vec4& view) {
+		drawn = rebuilt = 0;
+
+		// only the chunks in view are visited, whatever the size of the map
+		bool queued = false;
+		for (std::size_t l = 0; l < map.layers.size(); l++) {
+			if (hidden_[l]) continue;
+
+			if (y_sorted_[l]) {
+				queue_(l, map.cells_in(l, view.x, view.y, view.z, view.w));
+				queued = true;
+				continue;
+			}
+
+			if (queued) flush_();
+			queued = false;
+
+			CellRange range = map.chunks_in(l, view.x, view.y, view.z, view.w);
+			int chunks_x = map.layers[l].chunks_x();
+
+			for (int y = range.row_begin; y < range.row_end; y++) {
+				for (int x = range.col_begin; x < range.col_end; x++) {
+					draw_(*chunks_[layer_chunks_[l] + (std::size_t)y * chunks_x + x]);
+				}
+			}
+		}
+	}
+
+	void MapRenderer::flush_() {
+		// the cells queued so far go under the static layer drawn next
+		if (!sprites.queuing()) return;
+		sprites.end();
+		sprites.begin();
+	}
+}
@@ -0,0 +1,136 @@
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <mapped_file.hpp>
+
+MappedFile::MappedFile(const std::string& filename, bool writable) {
+	open(filename, writable);
+}
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& rhs) {
+	*this = std::move(rhs);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& rhs) {
+	if (this != &rhs) {
+		close();
+		std::swap(data_, rhs.data_);
+		std::swap(size_, rhs.size_);
+#ifdef _WIN32
+		std::swap(file_, rhs.file_);
+		std::swap(mapping_, rhs.mapping_);
+#endif
+	}
+	return *this;
+}
+
+#ifdef _WIN32
+
+bool MappedFile::open(const std::string& filename, bool writable) {
+	close();
+
+	HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+	                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, writable ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) {
+		CloseHandle(file);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if (!data) {
+		CloseHandle(mapping);
+		CloseHandle(file);
+		return false;
+	}
+
+	file_ = file;
+	mapping_ = mapping;
+	data_ = (unsigned char*)data;
+	size_ = (std::size_t)size.QuadPart;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) UnmapViewOfFile(data_);
+	if (mapping_) CloseHandle(mapping_);
+	if (file_) CloseHandle(file_);
+
+	data_ = nullptr;
+	size_ = 0;
+	file_ = mapping_ = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string& filename, bool writable) {
+	close();
+
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+	void* data = mmap(nullptr, (std::size_t)st.st_size, prot, MAP_PRIVATE, fd, 0);
+	::close(fd);
+
+	if (data == MAP_FAILED) return false;
+
+	data_ = (unsigned char*)data;
+	size_ = (std::size_t)st.st_size;
+	return true;
+}
+
+void MappedFile::close() {
+	if (data_) munmap(data_, size_);
+
+	data_ = nullptr;
+	size_ = 0;
+}
+
+#endif
+
+std::int64_t file_mtime(const std::string& filename) {
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &data)) return -1;
+
+	// 100 ns intervals since 1601
+	std::int64_t ticks = (std::int64_t)data.ftLastWriteTime.dwHighDateTime << 32 | data.ftLastWriteTime.dwLowDateTime;
+	return (ticks - 116444736000000000LL) * 100;
+#else
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) return -1;
+#ifdef __APPLE__
+	return (std::int64_t)st.st_mtimespec.tv_sec * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+	return (std::int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+}
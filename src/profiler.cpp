@@ -0,0 +1,311 @@
+#include <profiler.hpp>
+
+#ifdef KURATKO_PROFILER
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+namespace prof
+{
+	const uint32_t ZoneRing::capacity;
+	const std::size_t Frame::max_zones;
+	const int Profiler::history_size;
+	const int Profiler::trace_capacity;
+	const int Profiler::gpu_latency;
+
+	void ZoneRing::push(const Zone& zone) {
+		uint32_t head = head_.load(std::memory_order_relaxed);
+		uint32_t tail = tail_.load(std::memory_order_acquire);
+
+		if (head - tail == capacity) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		zones_[head & (capacity - 1)] = zone;
+		head_.store(head + 1, std::memory_order_release);
+	}
+
+	Profiler::Profiler(): frames_(trace_capacity) {
+		current_.begin = now();
+
+		// recording a frame should not allocate, frame() swaps these in
+		for (auto&& frame : frames_) {
+			frame.zones.reserve(Frame::max_zones);
+			frame.gpu_zones.reserve(16);
+		}
+		current_.zones.reserve(Frame::max_zones);
+		current_.gpu_zones.reserve(16);
+	}
+
+	ZoneRing& Profiler::ring() {
+		thread_local ZoneRing* ring = nullptr;
+
+		if (!ring) {
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			// rings live as long as the process, a thread may still be pushing
+			// into one while another thread ends the frame
+			ring = new ZoneRing((int)rings_.size());
+			rings_.push_back(ring);
+		}
+
+		return *ring;
+	}
+
+	void Profiler::frame() {
+		current_.end = now();
+
+		{
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			for (auto ring : rings_) {
+				ring->drain([this, ring](const Zone& zone) {
+					if (current_.zones.size() < Frame::max_zones) current_.zones.push_back(zone);
+					else ring->dropped.fetch_add(1, std::memory_order_relaxed);
+				});
+			}
+		}
+
+		std::sort(current_.zones.begin(), current_.zones.end(), [](const Zone& a, const Zone& b) {
+			return a.thread != b.thread ? a.thread < b.thread : a.begin < b.begin;
+		});
+
+		history[history_offset] = (current_.end - current_.begin) / 1000.0f;
+		history_offset = (history_offset + 1) % history_size;
+
+		resolve_gpu_frames_();
+
+		// the slot of the oldest frame is reused, so are its vectors
+		Frame& last = frames_[current_.index % trace_capacity];
+		std::swap(last, current_);
+		current_.index = last.index + 1;
+		current_.begin = last.end;
+		current_.zones.clear();
+		current_.gpu_zones.clear();
+
+		// frame 0 also covers loading everything before the game loop
+		if (spike_budget_ > 0 && !spike_pending_ && last.index > 0 && last.end - last.begin > spike_budget_) {
+			spike_pending_ = true;
+			spike_index_ = last.index;
+			spike_dump_at_ = last.index + spike_frames_ / 2;
+			std::cerr << "WARNING: frame " << last.index << " took " << (last.end - last.begin) / 1000.0f << " ms" << std::endl;
+		}
+
+		if (spike_pending_ && last.index >= spike_dump_at_) {
+			std::string filename = "spike_" + std::to_string(spike_index_) + ".json";
+			if (write_trace(filename, spike_frames_)) {
+				std::cerr << "WARNING: wrote " << filename << std::endl;
+			}
+			spike_pending_ = false;
+		}
+	}
+
+	void Profiler::set_spike_budget(float ms, int frames) {
+		spike_budget_ = (int64_t)(ms * 1000.0f);
+		spike_frames_ = std::max(1, std::min(frames, trace_capacity));
+		spike_pending_ = false;
+	}
+
+	namespace
+	{
+		void write_event(std::ostream& out, bool& first, const char* name, const char* category, int64_t ts, int64_t dur, int tid) {
+			out << (first ? "\n" : ",\n") << "{\"name\":\"";
+			for (const char* c = name; *c; c++) {
+				if (*c == '"' || *c == '\\') out << '\\';
+				out << *c;
+			}
+			out << "\",\"cat\":\"" << category << "\",\"ph\":\"X\",\"ts\":" << ts
+				<< ",\"dur\":" << dur << ",\"pid\":1,\"tid\":" << tid << "}";
+			first = false;
+		}
+
+		void write_thread_name(std::ostream& out, int tid, const std::string& name) {
+			out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+				<< ",\"args\":{\"name\":\"" << name << "\"}}";
+		}
+	}
+
+	bool Profiler::write_trace(const std::string& filename, int frames) const {
+		std::ofstream out(filename);
+		if (!out) {
+			std::cerr << "ERROR: cannot write trace " << filename << std::endl;
+			return false;
+		}
+
+		// tid 0 are the frames, GPU zones go after the CPU threads
+		int gpu_tid = 1;
+		{
+			std::lock_guard<std::mutex> lock(rings_mutex_);
+			gpu_tid += (int)rings_.size();
+		}
+
+		uint64_t count = std::min<uint64_t>(std::min(frames, trace_capacity), current_.index);
+
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+
+		for (uint64_t index = current_.index - count; index < current_.index; index++) {
+			const Frame& frame = frames_[index % trace_capacity];
+
+			write_event(out, first, ("frame " + std::to_string(frame.index)).c_str(), "frame",
+				frame.begin, frame.end - frame.begin, 0);
+
+			for (auto&& zone : frame.zones) {
+				write_event(out, first, zone.name, "cpu", zone.begin, zone.end - zone.begin, zone.thread + 1);
+			}
+
+			// GPU times are only known relative to the frame, line them up with its start
+			for (auto&& zone : frame.gpu_zones) {
+				write_event(out, first, zone.name, "gpu", frame.begin + zone.begin, zone.end - zone.begin, gpu_tid);
+			}
+		}
+
+		if (!first) {
+			write_thread_name(out, 0, "frames");
+			for (int tid = 1; tid < gpu_tid; tid++) {
+				write_thread_name(out, tid, tid == 1 ? "main" : "thread " + std::to_string(tid - 1));
+			}
+			write_thread_name(out, gpu_tid, "gpu");
+		}
+
+		out << "\n]}\n";
+		return (bool)out;
+	}
+
+	GLuint Profiler::query_() {
+		if (free_queries_.empty()) {
+			GLuint queries[16];
+			glGenQueries(16, queries);
+			free_queries_.insert(free_queries_.end(), queries, queries + 16);
+		}
+
+		GLuint query = free_queries_.back();
+		free_queries_.pop_back();
+		return query;
+	}
+
+	Profiler::GpuFrame& Profiler::start_gpu_frame_() {
+		GpuFrame& frame = gpu_frames_[current_.index % gpu_latency];
+		if (frame.pending && frame.index == current_.index) return frame;
+
+		// the GPU is more than gpu_latency frames behind, that frame is lost
+		if (frame.pending) release_gpu_frame_(frame);
+
+		frame.index = current_.index;
+		frame.pending = true;
+		frame.start = query_();
+		glQueryCounter(frame.start, GL_TIMESTAMP);
+		return frame;
+	}
+
+	void Profiler::release_gpu_frame_(GpuFrame& frame) {
+		free_queries_.push_back(frame.start);
+		for (auto&& query : frame.queries) {
+			free_queries_.push_back(query.begin);
+			free_queries_.push_back(query.end);
+		}
+
+		// the slot keeps the capacity of its queries
+		frame.queries.clear();
+		frame.pending = false;
+	}
+
+	int Profiler::gpu_begin(const char* name, int depth) {
+		GpuFrame& frame = start_gpu_frame_();
+
+		GpuQuery query;
+		query.name = name;
+		query.depth = depth;
+		query.begin = query_();
+		query.end = 0;
+		glQueryCounter(query.begin, GL_TIMESTAMP);
+
+		frame.queries.push_back(query);
+		return (int)frame.queries.size() - 1;
+	}
+
+	void Profiler::gpu_end(int query) {
+		auto& zone = gpu_frames_[current_.index % gpu_latency].queries[query];
+		zone.end = query_();
+		glQueryCounter(zone.end, GL_TIMESTAMP);
+	}
+
+	void Profiler::resolve_gpu_frames_() {
+		// frames are issued in order, so once one is not ready neither are the
+		// ones after it; the frame being recorded is never resolved
+		for (; gpu_resolve_next_ < current_.index; gpu_resolve_next_++) {
+			GpuFrame& frame = gpu_frames_[gpu_resolve_next_ % gpu_latency];
+			// no GPU zones in that frame, or given up
+			if (!frame.pending || frame.index != gpu_resolve_next_) continue;
+
+			GLuint last = frame.queries.empty() ? frame.start : frame.queries.back().end;
+			GLint available = 0;
+			glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+
+			GLuint64 start;
+			glGetQueryObjectui64v(frame.start, GL_QUERY_RESULT, &start);
+
+			last_gpu_.index = frame.index;
+			last_gpu_.begin = 0;
+			last_gpu_.end = 0;
+			last_gpu_.zones.clear();
+
+			for (auto&& query : frame.queries) {
+				GLuint64 begin, end;
+				glGetQueryObjectui64v(query.begin, GL_QUERY_RESULT, &begin);
+				glGetQueryObjectui64v(query.end, GL_QUERY_RESULT, &end);
+
+				Zone zone;
+				zone.name = query.name;
+				zone.begin = (int64_t)(begin - start) / 1000;
+				zone.end = (int64_t)(end - start) / 1000;
+				zone.depth = query.depth;
+				zone.thread = 0;
+				last_gpu_.zones.push_back(zone);
+
+				last_gpu_.end = std::max(last_gpu_.end, zone.end);
+			}
+
+			// still in the trace history (always, unless GPU results lag by
+			// more than trace_capacity frames)
+			Frame& traced = frames_[frame.index % trace_capacity];
+			if (traced.index == frame.index) {
+				traced.gpu_zones = last_gpu_.zones;
+			}
+
+			release_gpu_frame_(frame);
+		}
+	}
+
+	Profiler& profiler() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	ScopedZone::ScopedZone(const char* name):
+		name_(name), begin_(profiler().now()), ring_(profiler().ring()) {
+		ring_.depth++;
+	}
+
+	ScopedZone::~ScopedZone() {
+		ring_.depth--;
+
+		Zone zone;
+		zone.name = name_;
+		zone.begin = begin_;
+		zone.end = profiler().now();
+		zone.depth = ring_.depth;
+		zone.thread = ring_.thread;
+		ring_.push(zone);
+	}
+
+	ScopedGpuZone::ScopedGpuZone(const char* name):
+		cpu_(name), query_(profiler().gpu_begin(name, cpu_.depth())) {}
+
+	ScopedGpuZone::~ScopedGpuZone() {
+		profiler().gpu_end(query_);
+	}
+}
+
+#endif
@@ -0,0 +1,111 @@
+#include <profiler.hpp>
+
+#ifdef KURATKO_PROFILER
+
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+
+#include <imgui.h>
+
+namespace prof
+{
+	namespace
+	{
+		const float row_height = 18.0f;
+		// threads past these are left out of the bars
+		const int max_threads = 64;
+
+		ImU32 zone_color(const char* name) {
+			// stable color per zone name (the names are string literals)
+			size_t hash = std::hash<const void*>()(name);
+			float r = 0.35f + 0.4f * ((hash >> 4) & 0xff) / 255.0f;
+			float g = 0.35f + 0.4f * ((hash >> 12) & 0xff) / 255.0f;
+			float b = 0.35f + 0.4f * ((hash >> 20) & 0xff) / 255.0f;
+			return ImColor(r, g, b);
+		}
+
+		// One row per depth, threads stacked below each other, bars scaled to
+		// the frame length.
+		void draw_bars(const Frame& frame) {
+			// drawn every frame while the overlay is open, nothing allocates
+			int first_row[max_threads] = {};
+			int threads = 0;
+			for (auto&& zone : frame.zones) {
+				if (zone.thread >= max_threads) continue;
+				first_row[zone.thread] = std::max(first_row[zone.thread], zone.depth + 1);
+				threads = std::max(threads, zone.thread + 1);
+			}
+
+			int rows = 0;
+			for (int thread = 0; thread < threads; thread++) {
+				int depth = first_row[thread];
+				first_row[thread] = rows;
+				rows += depth;
+			}
+
+			ImDrawList* draw_list = ImGui::GetWindowDrawList();
+			ImVec2 origin = ImGui::GetCursorScreenPos();
+			float width = ImGui::GetContentRegionAvailWidth();
+			float length = (float)std::max<int64_t>(frame.end - frame.begin, 1);
+
+			for (auto&& zone : frame.zones) {
+				if (zone.thread >= max_threads) continue;
+
+				// zones of other threads may have started in an earlier frame
+				float x0 = origin.x + width * std::max<int64_t>(zone.begin - frame.begin, 0) / length;
+				float x1 = origin.x + width * (zone.end - frame.begin) / length;
+				float y0 = origin.y + row_height * (first_row[zone.thread] + zone.depth);
+
+				ImVec2 a(x0, y0);
+				ImVec2 b(std::max(x1, x0 + 1.0f), y0 + row_height - 1.0f);
+				draw_list->AddRectFilled(a, b, zone_color(zone.name));
+
+				if (ImGui::CalcTextSize(zone.name).x < b.x - a.x - 4.0f) {
+					draw_list->AddText(ImVec2(a.x + 2.0f, a.y + 1.0f), ImColor(0.0f, 0.0f, 0.0f), zone.name);
+				}
+
+				if (ImGui::IsMouseHoveringRect(a, b)) {
+					ImGui::SetTooltip("%s: %.3f ms", zone.name, (zone.end - zone.begin) / 1000.0f);
+				}
+			}
+
+			ImGui::Dummy(ImVec2(width, row_height * std::max(rows, 1)));
+		}
+
+		void draw_table(const Frame& frame) {
+			for (auto&& zone : frame.zones) {
+				ImGui::Text("%*s%-*s %8.3f ms", zone.depth * 2, "", 24 - zone.depth * 2, zone.name,
+					(zone.end - zone.begin) / 1000.0f);
+			}
+		}
+	}
+
+	void draw_overlay() {
+		const Profiler& p = profiler();
+		const Frame& cpu = p.last_frame();
+		const Frame& gpu = p.last_gpu_frame();
+
+		ImGui::Begin("Profiler");
+
+		char overlay[64];
+		snprintf(overlay, sizeof(overlay), "cpu %.2f ms  gpu %.2f ms",
+			(cpu.end - cpu.begin) / 1000.0f, (gpu.end - gpu.begin) / 1000.0f);
+		ImGui::PlotLines("##frames", p.history, Profiler::history_size, p.history_offset,
+			overlay, 0.0f, 33.3f, ImVec2(0, 60));
+
+		ImGui::Text("CPU, frame %llu", (unsigned long long)cpu.index);
+		draw_bars(cpu);
+
+		ImGui::Text("GPU, frame %llu", (unsigned long long)gpu.index);
+		draw_bars(gpu);
+
+		if (ImGui::CollapsingHeader("Zones")) {
+			draw_table(cpu);
+		}
+
+		ImGui::End();
+	}
+}
+
+#endif
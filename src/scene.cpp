@@ -0,0 +1,204 @@
+#include <iostream>
+#include <vector>
+
+#include <scene.hpp>
+#include <mapped_file.hpp>
+#include <profiler.hpp>
+
+namespace
+{
+	// The archive leaves out a map whose .tmx changed since it was cooked
+	// (see AssetArchive::open), the .kmap of tmx2kmap is used unless the
+	// .tmx is newer.
+	TileMap load_map(const std::string& name, const gl::AssetArchive& archive) {
+		if (auto cooked = archive.find(name + ".kmap")) {
+			std::cerr << "loading " << name << ".kmap from the asset archive" << std::endl;
+			return load_binary_map(archive.file(), cooked->offset, cooked->size, name + ".kmap");
+		}
+
+		std::int64_t kmap_mtime = file_mtime(name + ".kmap");
+		if (kmap_mtime >= 0 && kmap_mtime >= file_mtime(name + ".tmx")) {
+			std::cerr << "loading " << name << ".kmap" << std::endl;
+			return load_binary_map(name + ".kmap");
+		}
+		std::cerr << "loading " << name << ".tmx" << std::endl;
+		return load_tiles(name + ".tmx");
+	}
+
+	const gl::AssetArchive::Entry* find_cooked_tile(const gl::AssetArchive& archive, const std::string& filename) {
+		auto entry = archive.find(filename);
+		return entry && entry->type == gl::AssetArchive::texture ? entry : nullptr;
+	}
+
+	// Loads the tiles that some cell of the map uses, `requested` gets their ids.
+	gl::TextureAtlas load_tile_atlas(const TileMap& map, gl::TextureLoader& loader, const gl::AssetArchive& archive,
+		std::unordered_set<int>& requested) {
+		PROFILE_ZONE("load tile atlas");
+
+		for (auto&& layer : map.layers) {
+			for (int gid : layer.gids) {
+				// tileset ids start at firstgid 1
+				if (gid) requested.insert(gid - 1);
+			}
+		}
+
+		// cooked tiles are copied out of the archive, the rest is decoded
+		std::vector<const gl::AssetArchive::Entry*> cooked(map.tiles.size());
+		std::vector<gl::DecodedImage> images(map.tiles.size());
+		for (std::size_t i = 0; i < map.tiles.size(); i++) {
+			if (!requested.count(map.tiles[i].gid)) continue;
+
+			std::string filename = "res/" + map.tiles[i].filename;
+
+			cooked[i] = find_cooked_tile(archive, filename);
+			if (!cooked[i]) loader.decode_png(filename, images[i]);
+		}
+		loader.finish();
+
+		// added in tile order, the packing does not depend on decode order
+		gl::AtlasBuilder builder;
+		// tiles of the grid size are layers of one array
+		builder.tile_width = map.tile_width;
+		builder.tile_height = map.tile_height;
+		for (std::size_t i = 0; i < map.tiles.size(); i++) {
+			if (!requested.count(map.tiles[i].gid)) continue;
+
+			if (auto entry = cooked[i]) {
+				std::size_t size = (std::size_t)entry->width * entry->height * 4;
+				builder.add(map.tiles[i].gid, (int)entry->width, (int)entry->height,
+					std::vector<unsigned char>(entry->data, entry->data + size));
+				continue;
+			}
+
+			auto&& image = images[i];
+			if (image.error) continue;
+
+			builder.add(map.tiles[i].gid, (int)image.width, (int)image.height, std::move(image.pixels));
+		}
+
+		builder.pack();
+
+		gl::TextureAtlas atlas;
+		atlas.load(builder);
+		return atlas;
+	}
+}
+
+Scene::Scene(const std::string& map_name, int width, int height, unsigned decode_threads,
+             const std::string& archive_name):
+	width(width), height(height),
+	archive(archive_name),
+	shader_sources([this](const std::string& path, std::string& code) { return archive.read(path, code); }),
+	sprite_shader("res/sprite"),
+	sprites(sprite_shader),
+	loader(decode_threads),
+	assets(loader, &archive),
+	map(load_map(map_name, archive)),
+	map_renderer(sprites, map, atlas),
+	tilemap(map, atlas),
+	// zoomed with the mouse wheel
+	camera(1.0f),
+	projection(glm::ortho(0.0f, (float)width, (float)height, 0.0f, -1.0f, 1.0f)) {
+
+	// filled here, requested_ is constructed after the atlas
+	atlas = load_tile_atlas(map, loader, archive, requested_);
+	map_renderer.on_missing = [this](int id) {
+		if (requested_.count(id)) return;
+		requested_.insert(id);
+		missing_.push_back(id);
+	};
+	tilemap.on_missing = map_renderer.on_missing;
+
+	glEnable(GL_BLEND);
+	// every texture is premultiplied (see premultiply_alpha)
+	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+	glViewport(0, 0, width, height);
+	tilemap.set_viewport(glm::vec4(0, 0, width, height));
+
+	// the ground is static, everything above it sorts against the player
+	for (std::size_t layer = 1; layer < map.layers.size(); layer++) {
+		map_renderer.set_y_sorted(layer);
+	}
+
+	player = assets.texture("res/kuratko_basic_klaciky.png");
+}
+
+void Scene::draw() {
+	using namespace gl;
+	using namespace glm;
+
+	PROFILE_ZONE("scene");
+
+	loader.update();
+	load_missing_tiles_();
+
+	glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+
+	int tile_size = map.tile_width;
+
+	sprites.stats.reset();
+	tilemap.stats.reset();
+	state_cache().reset_counters();
+
+	camera.update_camera();
+	sprite_shader.set("projection", camera.projection() * projection);
+
+	view_ = camera.visible_rect(projection);
+	sprites.set_cull_rect(view_);
+
+	sprites.begin();
+
+	{
+		PROFILE_GPU_ZONE("map");
+
+		// only the ground, the y-sorted layers are sprites either way
+		if (!map.layers.empty()) {
+			map_renderer.set_hidden(0, tilemap_shader);
+			if (tilemap_shader) tilemap.draw(0, camera.projection() * projection, view_);
+		}
+		map_renderer.draw(view_);
+	}
+
+	{
+		PROFILE_GPU_ZONE("sprites");
+		sprites.set_layer(map_renderer.sort_layer, true, map_renderer.sprite_order());
+		sprites.draw_sprite(*player, vec2(player_x * tile_size, player_y * tile_size));
+		sprites.end();
+	}
+
+	assets.update();
+}
+
+void Scene::load_missing_tiles_() {
+	// finished first, the chunks missing them are rebuilt in this frame
+	for (auto it = late_tiles_.begin(); it != late_tiles_.end();) {
+		auto&& image = it->image;
+		if (image.pixels.empty() && !image.error) {
+			++it;
+			continue;
+		}
+
+		if (!image.error) atlas.insert(it->id, (int)image.width, (int)image.height, image.pixels.data());
+		it = late_tiles_.erase(it);
+	}
+
+	for (int id : missing_) {
+		const Tile* tile = map.find_tile(id);
+		if (!tile) continue;
+
+		PROFILE_ZONE("load late tile");
+
+		std::string filename = "res/" + tile->filename;
+		if (auto cooked = find_cooked_tile(archive, filename)) {
+			atlas.insert(id, (int)cooked->width, (int)cooked->height, cooked->data);
+			continue;
+		}
+
+		late_tiles_.push_back({ id, {} });
+		loader.decode_png(filename, late_tiles_.back().image);
+	}
+
+	missing_.clear();
+}
@@ -0,0 +1,188 @@
+#include <iostream>
+
+#include <lodepng.h>
+
+#include <texture_loader.hpp>
+#include <profiler.hpp>
+
+namespace gl
+{
+	const std::size_t TextureLoader::frame_budget;
+	const std::size_t TextureLoader::unpack_size;
+
+	unsigned TextureLoader::default_threads() {
+		unsigned threads = std::thread::hardware_concurrency();
+		return threads > 1 ? threads - 1 : 1;
+	}
+
+	TextureLoader::TextureLoader(unsigned threads) {
+		for (unsigned i = 0; i < threads; i++) {
+			workers_.emplace_back([this] { work_(); });
+		}
+	}
+
+	TextureLoader::~TextureLoader() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		queued_cv_.notify_all();
+
+		for (auto&& worker : workers_) {
+			worker.join();
+		}
+	}
+
+	void TextureLoader::load_png(Texture2D& texture, const std::string& filename) {
+		texture.load(1, 1, placeholder);
+		texture.ready = false;
+
+		queue_({ filename, &texture, nullptr, {}, nullptr, 0 });
+	}
+
+	void TextureLoader::load_png(Texture2D& texture, const std::string& name, const unsigned char* png, std::size_t size) {
+		texture.load(1, 1, placeholder);
+		texture.ready = false;
+
+		queue_({ name, &texture, nullptr, {}, png, size });
+	}
+
+	void TextureLoader::decode_png(const std::string& filename, DecodedImage& image) {
+		queue_({ filename, nullptr, &image, {}, nullptr, 0 });
+	}
+
+	void TextureLoader::queue_(Job job) {
+		pending_++;
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			queued_.push_back(std::move(job));
+		}
+		queued_cv_.notify_one();
+	}
+
+	void TextureLoader::work_() {
+		for (;;) {
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				queued_cv_.wait(lock, [this] { return stop_ || !queued_.empty(); });
+				if (stop_) return;
+
+				job = std::move(queued_.front());
+				queued_.pop_front();
+			}
+
+			decode_(job);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				decoded_.push_back(std::move(job));
+			}
+			decoded_cv_.notify_one();
+		}
+	}
+
+	void TextureLoader::decode_(Job& job) {
+		PROFILE_ZONE("decode png");
+
+		auto&& image = job.decoded;
+		if (job.png) image.error = lodepng::decode(image.pixels, image.width, image.height, job.png, job.png_size);
+		else image.error = lodepng::decode(image.pixels, image.width, image.height, job.filename);
+		if (image.error) return;
+
+		premultiply_alpha(image.pixels.data(), image.pixels.size() / 4);
+
+		// textures get their mips here, off the GL thread
+		if (job.texture) image.pixels = build_mip_chain(image.pixels, image.width, image.height, image.levels);
+	}
+
+	int TextureLoader::update(std::size_t budget) {
+		int finished = 0;
+		std::size_t uploaded = 0;
+
+		while (uploaded < budget) {
+			Job job;
+			bool decoded = true;
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (!decoded_.empty()) {
+					job = std::move(decoded_.front());
+					decoded_.pop_front();
+				} else if (workers_.empty() && !queued_.empty()) {
+					job = std::move(queued_.front());
+					queued_.pop_front();
+					decoded = false;
+				} else {
+					break;
+				}
+			}
+
+			if (!decoded) decode_(job);
+			uploaded += finish_(job);
+			finished++;
+		}
+
+		return finished;
+	}
+
+	void TextureLoader::finish() {
+		PROFILE_ZONE("texture loader finish");
+
+		while (pending_ > 0) {
+			Job job;
+			bool decoded;
+			{
+				// finished images first, then help with the queue, and only
+				// wait when every remaining image is being decoded
+				std::unique_lock<std::mutex> lock(mutex_);
+				decoded_cv_.wait(lock, [this] { return !decoded_.empty() || !queued_.empty(); });
+
+				decoded = !decoded_.empty();
+				auto&& from = decoded ? decoded_ : queued_;
+				job = std::move(from.front());
+				from.pop_front();
+			}
+
+			if (!decoded) decode_(job);
+			finish_(job);
+		}
+	}
+
+	std::size_t TextureLoader::finish_(Job& job) {
+		pending_--;
+
+		auto&& image = job.decoded;
+		if (image.error) {
+			std::cerr << "ERROR: failed to load " << job.filename << ": " << lodepng_error_text(image.error) << std::endl;
+			if (job.texture) job.texture->invalid = true;
+		}
+
+		if (job.image) {
+			*job.image = std::move(image);
+			return 0;
+		}
+
+		if (image.error) return 0;
+
+		PROFILE_ZONE("texture upload");
+
+		Texture2D& texture = *job.texture;
+		std::size_t bytes = image.pixels.size();
+
+		if (bytes > unpack_size) {
+			texture.load_levels(image.width, image.height, image.levels, image.pixels.data());
+			return bytes;
+		}
+
+		if (!unpack_) unpack_.reset(new StreamBuffer(unpack_size, GL_PIXEL_UNPACK_BUFFER));
+
+		// the copy into the texture is queued behind the draws, the ring's
+		// fences keep the region alive until the GPU has read it
+		GLintptr offset = unpack_->write(image.pixels.data(), bytes);
+		unpack_->bind();
+		texture.load_levels(image.width, image.height, image.levels, reinterpret_cast<unsigned char*>(offset));
+		state_cache().bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		return bytes;
+	}
+}
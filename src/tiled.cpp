@@ -0,0 +1,611 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <lodepng.h>
+
+#include <binary_io.hpp>
+#include <mapped_file.hpp>
+#include <profiler.hpp>
+#include <tiled.hpp>
+
+namespace
+{
+	// Tiled stores the flip flags of a tile in the top bits of its gid.
+	const uint32_t gid_flags = 0xE0000000u;
+
+	// Pull parser over an in-memory XML document. It only walks the tags and
+	// their attributes in document order, nothing is allocated per element.
+	class XmlReader
+	{
+	public:
+		enum Kind { Open, Close, End };
+
+		Kind kind = End;
+		bool self_closing = false;
+
+		XmlReader(const char* begin, const char* end): p_(begin), end_(end) {}
+
+		bool is(const char* name) const {
+			std::size_t len = strlen(name);
+			return name_len_ == len && strncmp(name_, name, len) == 0;
+		}
+
+		// Moves to the next opening or closing tag, skipping the prolog,
+		// comments and text.
+		Kind next() {
+			while (true) {
+				p_ = std::find(p_, end_, '<');
+				if (p_ == end_) return kind = End;
+
+				if (starts_with_("<!--")) {
+					skip_past_("-->");
+				} else if (starts_with_("<?") || starts_with_("<!")) {
+					skip_past_(">");
+				} else {
+					break;
+				}
+			}
+
+			p_++;
+			kind = Open;
+			if (*p_ == '/') {
+				kind = Close;
+				p_++;
+			}
+
+			name_ = p_;
+			while (p_ < end_ && !isspace((unsigned char)*p_) && *p_ != '>' && *p_ != '/') p_++;
+			name_len_ = p_ - name_;
+
+			attrs_ = p_;
+			char quote = 0;
+			while (p_ < end_ && (quote || *p_ != '>')) {
+				if (quote) {
+					if (*p_ == quote) quote = 0;
+				} else if (*p_ == '"' || *p_ == '\'') {
+					quote = *p_;
+				}
+				p_++;
+			}
+			attrs_end_ = p_;
+
+			self_closing = attrs_end_ > attrs_ && attrs_end_[-1] == '/';
+			if (p_ < end_) p_++;
+
+			return kind;
+		}
+
+		// Raw value of an attribute of the current tag.
+		bool attribute(const char* name, const char*& value, std::size_t& len) const {
+			std::size_t name_len = strlen(name);
+			const char* a = attrs_;
+
+			while (a < attrs_end_) {
+				while (a < attrs_end_ && (isspace((unsigned char)*a) || *a == '/')) a++;
+
+				const char* key = a;
+				while (a < attrs_end_ && *a != '=' && !isspace((unsigned char)*a)) a++;
+				std::size_t key_len = a - key;
+
+				while (a < attrs_end_ && (*a == '=' || isspace((unsigned char)*a))) a++;
+				if (a >= attrs_end_) break;
+
+				char quote = *a++;
+				const char* v = a;
+				while (a < attrs_end_ && *a != quote) a++;
+
+				if (key_len == name_len && strncmp(key, name, name_len) == 0) {
+					value = v;
+					len = a - v;
+					return true;
+				}
+				a++;
+			}
+
+			return false;
+		}
+
+		int int_attribute(const char* name, int fallback = 0) const {
+			const char* v;
+			std::size_t len;
+			return attribute(name, v, len) ? (int)strtoll(v, nullptr, 10) : fallback;
+		}
+
+		std::string string_attribute(const char* name) const {
+			const char* v;
+			std::size_t len;
+			if (!attribute(name, v, len)) return {};
+
+			std::string s(v, len);
+			unescape_(s);
+			return s;
+		}
+
+		// Character data up to the next tag.
+		void text(const char*& begin, const char*& end) const {
+			begin = p_;
+			end = std::find(p_, end_, '<');
+		}
+
+	private:
+		const char* p_;
+		const char* end_;
+
+		const char* name_ = nullptr;
+		std::size_t name_len_ = 0;
+		const char* attrs_ = nullptr;
+		const char* attrs_end_ = nullptr;
+
+		bool starts_with_(const char* s) const {
+			std::size_t len = strlen(s);
+			return (std::size_t)(end_ - p_) >= len && strncmp(p_, s, len) == 0;
+		}
+
+		void skip_past_(const char* s) {
+			std::size_t len = strlen(s);
+			const char* found = std::search(p_, end_, s, s + len);
+			p_ = found == end_ ? end_ : found + len;
+		}
+
+		static void unescape_(std::string& s) {
+			static const char* entities[][2] = {
+				{ "&amp;", "&" }, { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }
+			};
+
+			for (auto&& e : entities) {
+				std::size_t pos = 0;
+				while ((pos = s.find(e[0], pos)) != std::string::npos) {
+					s.replace(pos, strlen(e[0]), e[1]);
+					pos++;
+				}
+			}
+		}
+	};
+
+	void parse_csv(const char* p, const char* end, GidView& gids) {
+		std::size_t n = 0;
+
+		while (p < end && n < gids.size()) {
+			while (p < end && !isdigit((unsigned char)*p)) p++;
+			if (p == end) break;
+
+			uint32_t gid = 0;
+			while (p < end && isdigit((unsigned char)*p)) gid = gid * 10 + (*p++ - '0');
+
+			gids[n++] = (int)(gid & ~gid_flags);
+		}
+	}
+
+	void decode_base64(const char* p, const char* end, std::vector<unsigned char>& out) {
+		static signed char table[256];
+		static bool initialized = false;
+		if (!initialized) {
+			const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+			memset(table, -1, sizeof(table));
+			for (int i = 0; i < 64; i++) table[(unsigned char)alphabet[i]] = (signed char)i;
+			initialized = true;
+		}
+
+		out.reserve((end - p) * 3 / 4);
+
+		uint32_t acc = 0;
+		int bits = 0;
+		for (; p < end; p++) {
+			int v = table[(unsigned char)*p];
+			if (v < 0) continue; // whitespace and '=' padding
+
+			acc = (acc << 6) | (uint32_t)v;
+			bits += 6;
+			if (bits >= 8) {
+				bits -= 8;
+				out.push_back((unsigned char)(acc >> bits));
+			}
+		}
+	}
+
+	// Strips the gzip header (RFC 1952) so the deflate stream can go to lodepng.
+	bool skip_gzip_header(const std::vector<unsigned char>& in, std::size_t& offset) {
+		if (in.size() < 18 || in[0] != 0x1f || in[1] != 0x8b || in[2] != 8) return false;
+
+		unsigned char flags = in[3];
+		offset = 10;
+		if (flags & 4) offset += 2 + (in[offset] | (in[offset + 1] << 8)); // FEXTRA
+		if (flags & 8) while (offset < in.size() && in[offset++]) {}       // FNAME
+		if (flags & 16) while (offset < in.size() && in[offset++]) {}      // FCOMMENT
+		if (flags & 2) offset += 2;                                        // FHCRC
+
+		return offset < in.size();
+	}
+
+	void parse_base64(const char* p, const char* end, const std::string& compression, GidView& gids) {
+		std::vector<unsigned char> raw;
+		decode_base64(p, end, raw);
+
+		std::vector<unsigned char> inflated;
+		unsigned error = 0;
+
+		if (compression == "zlib") {
+			error = lodepng::decompress(inflated, raw);
+		} else if (compression == "gzip") {
+			std::size_t offset;
+			if (!skip_gzip_header(raw, offset)) {
+				std::cerr << "ERROR: invalid gzip layer data" << std::endl;
+				throw "Invalid gzip layer data";
+			}
+
+			unsigned char* out = nullptr;
+			std::size_t outsize = 0;
+			error = lodepng_inflate(&out, &outsize, raw.data() + offset, raw.size() - offset, &lodepng_default_decompress_settings);
+			if (!error) inflated.assign(out, out + outsize);
+			free(out);
+		} else if (!compression.empty()) {
+			std::cerr << "ERROR: unsupported layer compression " << compression << std::endl;
+			throw "Unsupported layer compression";
+		}
+
+		if (error) {
+			std::cerr << "ERROR: layer data failed to decompress: " << lodepng_error_text(error) << std::endl;
+			throw "Layer data failed to decompress";
+		}
+
+		const std::vector<unsigned char>& bytes = compression.empty() ? raw : inflated;
+		std::size_t n = std::min(gids.size(), bytes.size() / 4);
+
+		for (std::size_t i = 0; i < n; i++) {
+			const unsigned char* b = &bytes[4 * i];
+			uint32_t gid = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+			gids[i] = (int)(gid & ~gid_flags);
+		}
+	}
+}
+
+const int TileLayer::chunk_size;
+
+GidView GidView::allocate(std::size_t size) {
+	auto storage = std::make_shared<std::vector<int>>(size, 0);
+	return GidView(storage->data(), size, storage);
+}
+
+void TileLayer::set_gid(std::size_t i, std::size_t j, int gid) {
+	gids[i * width + j] = gid;
+
+	if (revisions_.empty()) revisions_.assign((std::size_t)chunks_x() * chunks_y(), 0);
+	revisions_[(i / chunk_size) * chunks_x() + j / chunk_size]++;
+}
+
+CellRange TileMap::cells_in(std::size_t layer, float left, float top, float right, float bottom) const {
+	const TileLayer& l = layers[layer];
+
+	auto clamp = [](float v, int hi) { return (int)std::min(std::max(v, 0.0f), (float)hi); };
+
+	CellRange range;
+	range.col_begin = clamp(std::floor(left / tile_width), l.width);
+	range.row_begin = clamp(std::floor(top / tile_height), l.height);
+	range.col_end = clamp(std::ceil(right / tile_width), l.width);
+	range.row_end = clamp(std::ceil(bottom / tile_height), l.height);
+	return range;
+}
+
+CellRange TileMap::chunks_in(std::size_t layer, float left, float top, float right, float bottom) const {
+	CellRange cells = cells_in(layer, left, top, right, bottom);
+	if (cells.empty()) return CellRange();
+
+	const int n = TileLayer::chunk_size;
+
+	CellRange range;
+	range.col_begin = cells.col_begin / n;
+	range.row_begin = cells.row_begin / n;
+	range.col_end = (cells.col_end + n - 1) / n;
+	range.row_end = (cells.row_end + n - 1) / n;
+	return range;
+}
+
+const Tile* TileMap::find_tile(int gid) const {
+	auto it = std::lower_bound(tiles.begin(), tiles.end(), gid,
+		[](const Tile& t, int gid) { return t.gid < gid; });
+
+	return it != tiles.end() && it->gid == gid ? &*it : nullptr;
+}
+
+TileMap load_tiles(const std::string& filename) {
+	PROFILE_ZONE("load_tiles");
+
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) {
+		std::cerr << "ERROR: failed to open map " << filename << std::endl;
+		throw "Failed to open map";
+	}
+
+	std::stringstream str;
+	str << file.rdbuf();
+	std::string xml = str.str();
+
+	TileMap map;
+	XmlReader reader(xml.data(), xml.data() + xml.size());
+
+	// the <tile> element means a tileset entry inside <tileset> and a cell
+	// inside <data>
+	bool in_tileset = false;
+	bool in_data = false;
+	std::size_t next_cell = 0;
+
+	while (reader.next() != XmlReader::End) {
+		if (reader.kind == XmlReader::Close) {
+			if (reader.is("tileset")) in_tileset = false;
+			if (reader.is("data")) in_data = false;
+			continue;
+		}
+
+		if (reader.is("map")) {
+			map.width = reader.int_attribute("width");
+			map.height = reader.int_attribute("height");
+			map.tile_width = reader.int_attribute("tilewidth");
+			map.tile_height = reader.int_attribute("tileheight");
+		} else if (reader.is("tileset")) {
+			in_tileset = !reader.self_closing;
+		} else if (in_tileset && reader.is("tile")) {
+			map.tiles.push_back({ reader.int_attribute("id"), 0, 0, {} });
+		} else if (in_tileset && reader.is("image") && !map.tiles.empty()) {
+			Tile& tile = map.tiles.back();
+			tile.width = reader.int_attribute("width");
+			tile.height = reader.int_attribute("height");
+			tile.filename = reader.string_attribute("source");
+		} else if (reader.is("layer")) {
+			TileLayer layer;
+			layer.name = reader.string_attribute("name");
+			layer.width = reader.int_attribute("width", map.width);
+			layer.height = reader.int_attribute("height", map.height);
+			layer.gids = GidView::allocate((std::size_t)layer.width * layer.height);
+
+			map.layers.push_back(std::move(layer));
+			next_cell = 0;
+		} else if (reader.is("data") && !map.layers.empty()) {
+			in_data = !reader.self_closing;
+
+			std::string encoding = reader.string_attribute("encoding");
+			if (encoding.empty()) continue;
+
+			const char* begin;
+			const char* end;
+			reader.text(begin, end);
+
+			if (encoding == "csv") {
+				parse_csv(begin, end, map.layers.back().gids);
+			} else if (encoding == "base64") {
+				parse_base64(begin, end, reader.string_attribute("compression"), map.layers.back().gids);
+			} else {
+				std::cerr << "ERROR: unsupported layer encoding " << encoding << std::endl;
+				throw "Unsupported layer encoding";
+			}
+		} else if (in_data && reader.is("tile")) {
+			GidView& gids = map.layers.back().gids;
+			if (next_cell < gids.size()) {
+				gids[next_cell++] = (int)((uint32_t)reader.int_attribute("gid") & ~gid_flags);
+			}
+		}
+	}
+
+	std::stable_sort(map.tiles.begin(), map.tiles.end(),
+		[](const Tile& a, const Tile& b) { return a.gid < b.gid; });
+
+	return map;
+}
+
+namespace
+{
+	// Layout of a .kmap file, all integers little-endian:
+	//
+	//   MapHeader
+	//   MapTileEntry[tile_count]
+	//   MapLayerEntry[layer_count]
+	//   tile and layer names
+	//   int32 gids[width * height] of every layer, 4 byte aligned
+	const char map_magic[4] = { 'K', 'M', 'A', 'P' };
+	const uint32_t map_version = 2;
+
+	struct MapHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t width, height;
+		uint32_t tile_width, tile_height;
+		uint32_t tile_count;
+		uint32_t layer_count;
+	};
+
+	struct MapTileEntry
+	{
+		int32_t gid;
+		int32_t width, height;
+		uint32_t name_offset, name_length;
+	};
+
+	struct MapLayerEntry
+	{
+		uint64_t data_offset;
+		uint32_t width, height;
+		uint32_t name_offset, name_length;
+	};
+
+	void invalid_map(const std::string& filename, const char* reason) {
+		std::cerr << "ERROR: " << filename << " is not a valid binary map: " << reason << std::endl;
+		throw "Invalid binary map";
+	}
+
+	std::string read_name(const unsigned char* base, std::size_t size, uint32_t offset, uint32_t length,
+		const std::string& filename) {
+		if ((std::size_t)offset + length > size) invalid_map(filename, "name out of bounds");
+		return std::string((const char*)base + offset, length);
+	}
+}
+
+void save_binary_map(const TileMap& map, const std::string& filename) {
+	std::ofstream out(filename, std::ios::binary);
+	if (!out) {
+		std::cerr << "ERROR: failed to open " << filename << " for writing" << std::endl;
+		throw "Failed to write binary map";
+	}
+
+	save_binary_map(map, out);
+}
+
+void save_binary_map(const TileMap& map, std::ostream& out) {
+	uint64_t strings_offset = sizeof(MapHeader)
+		+ map.tiles.size() * sizeof(MapTileEntry)
+		+ map.layers.size() * sizeof(MapLayerEntry);
+
+	uint64_t strings_size = 0;
+	for (auto&& tile : map.tiles) strings_size += tile.filename.size();
+	for (auto&& layer : map.layers) strings_size += layer.name.size();
+
+	uint64_t data_offset = (strings_offset + strings_size + 3) / 4 * 4;
+
+	out.write(map_magic, sizeof(map_magic));
+	write_pod(out, map_version);
+	write_pod(out, (uint32_t)map.width);
+	write_pod(out, (uint32_t)map.height);
+	write_pod(out, (uint32_t)map.tile_width);
+	write_pod(out, (uint32_t)map.tile_height);
+	write_pod(out, (uint32_t)map.tiles.size());
+	write_pod(out, (uint32_t)map.layers.size());
+
+	uint32_t name_offset = (uint32_t)strings_offset;
+	for (auto&& tile : map.tiles) {
+		write_pod(out, (int32_t)tile.gid);
+		write_pod(out, (int32_t)tile.width);
+		write_pod(out, (int32_t)tile.height);
+		write_pod(out, name_offset);
+		write_pod(out, (uint32_t)tile.filename.size());
+		name_offset += (uint32_t)tile.filename.size();
+	}
+
+	uint64_t layer_offset = data_offset;
+	for (auto&& layer : map.layers) {
+		write_pod(out, layer_offset);
+		write_pod(out, (uint32_t)layer.width);
+		write_pod(out, (uint32_t)layer.height);
+		write_pod(out, name_offset);
+		write_pod(out, (uint32_t)layer.name.size());
+		name_offset += (uint32_t)layer.name.size();
+		layer_offset += 4 * layer.gids.size();
+	}
+
+	for (auto&& tile : map.tiles) out.write(tile.filename.data(), tile.filename.size());
+	for (auto&& layer : map.layers) out.write(layer.name.data(), layer.name.size());
+	for (uint64_t i = strings_offset + strings_size; i < data_offset; i++) out.put(0);
+
+	for (auto&& layer : map.layers) {
+		for (int gid : layer.gids) write_pod(out, (int32_t)gid);
+	}
+}
+
+TileMap load_binary_map(const std::string& filename) {
+	auto file = std::make_shared<MappedFile>();
+	if (!file->open(filename, true)) {
+		std::cerr << "ERROR: failed to map " << filename << std::endl;
+		throw "Failed to open binary map";
+	}
+
+	std::size_t size = file->size();
+	return load_binary_map(std::move(file), 0, size, filename);
+}
+
+TileMap load_binary_map(std::shared_ptr<MappedFile> file, std::size_t offset, std::size_t size, const std::string& filename) {
+	PROFILE_ZONE("load_binary_map");
+
+	// the caller's range has to lie within the mapping before anything is read
+	if (!file || offset > file->size() || size > file->size() - offset) {
+		invalid_map(filename, "range out of the file");
+	}
+
+	unsigned char* base = file->data() + offset;
+
+	if (size < sizeof(MapHeader)) invalid_map(filename, "truncated header");
+
+	MapHeader header;
+	memcpy(&header, base, sizeof(header));
+	fix_endian(header.version);
+	fix_endian(header.width);
+	fix_endian(header.height);
+	fix_endian(header.tile_width);
+	fix_endian(header.tile_height);
+	fix_endian(header.tile_count);
+	fix_endian(header.layer_count);
+
+	if (memcmp(header.magic, map_magic, sizeof(map_magic)) != 0) invalid_map(filename, "bad magic");
+	if (header.version != map_version) invalid_map(filename, "unsupported version");
+
+	std::size_t tiles_offset = sizeof(MapHeader);
+	std::size_t layers_offset = tiles_offset + (std::size_t)header.tile_count * sizeof(MapTileEntry);
+	if (layers_offset + (std::size_t)header.layer_count * sizeof(MapLayerEntry) > size) {
+		invalid_map(filename, "truncated tables");
+	}
+
+	TileMap map;
+	map.width = (int)header.width;
+	map.height = (int)header.height;
+	map.tile_width = (int)header.tile_width;
+	map.tile_height = (int)header.tile_height;
+	map.tiles.reserve(header.tile_count);
+	map.layers.reserve(header.layer_count);
+
+	for (uint32_t i = 0; i < header.tile_count; i++) {
+		MapTileEntry entry;
+		memcpy(&entry, base + tiles_offset + i * sizeof(MapTileEntry), sizeof(entry));
+		fix_endian(entry.gid);
+		fix_endian(entry.width);
+		fix_endian(entry.height);
+		fix_endian(entry.name_offset);
+		fix_endian(entry.name_length);
+
+		map.tiles.push_back({
+			entry.gid,
+			entry.width,
+			entry.height,
+			read_name(base, size, entry.name_offset, entry.name_length, filename)
+		});
+	}
+
+	for (uint32_t i = 0; i < header.layer_count; i++) {
+		MapLayerEntry entry;
+		memcpy(&entry, base + layers_offset + i * sizeof(MapLayerEntry), sizeof(entry));
+		fix_endian(entry.data_offset);
+		fix_endian(entry.width);
+		fix_endian(entry.height);
+		fix_endian(entry.name_offset);
+		fix_endian(entry.name_length);
+
+		// count * 4 could wrap around for a crafted width and height
+		std::size_t count = (std::size_t)entry.width * entry.height;
+		if (entry.data_offset % 4 != 0 || entry.data_offset > size || count > (size - entry.data_offset) / 4) {
+			invalid_map(filename, "layer data out of bounds");
+		}
+
+		TileLayer layer;
+		layer.name = read_name(base, size, entry.name_offset, entry.name_length, filename);
+		layer.width = (int)entry.width;
+		layer.height = (int)entry.height;
+
+		if (little_endian()) {
+			layer.gids = GidView((int*)(base + entry.data_offset), count, file);
+		} else {
+			layer.gids = GidView::allocate(count);
+			for (std::size_t j = 0; j < count; j++) {
+				uint32_t gid;
+				memcpy(&gid, base + entry.data_offset + 4 * j, 4);
+				layer.gids[j] = (int)swap32(gid);
+			}
+		}
+
+		map.layers.push_back(std::move(layer));
+	}
+
+	return map;
+}
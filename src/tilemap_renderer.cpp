@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include <tilemap_renderer.hpp>
+#include <profiler.hpp>
+
+namespace gl
+{
+	namespace
+	{
+		// bit 0 is the tile array (page -1)
+		std::uint32_t page_bit(int page) {
+			return 1u << std::min(page + 1, 31);
+		}
+	}
+
+	TilemapRenderer::TilemapRenderer(TileMap& map, TextureAtlas& atlas):
+		map(map), atlas(atlas), shader("res/tilemap"), layers_(map.layers.size()) {
+
+		projection_ = shader.uniform("projection");
+		rect_ = shader.uniform("rect");
+		page_ = shader.uniform("page");
+		tile_size_ = shader.uniform("tile_size");
+		viewport_ = shader.uniform("viewport");
+
+		GLint subpixel_bits;
+		glGetIntegerv(GL_SUBPIXEL_BITS, &subpixel_bits);
+		shader.set("subpixel", (float)(1 << subpixel_bits));
+
+		GLint viewport[4];
+		glGetIntegerv(GL_VIEWPORT, viewport);
+		set_viewport(glm::vec4(viewport[0], viewport[1], viewport[2], viewport[3]));
+
+		shader.set("image", 0);
+		shader.set("gids", 1);
+		shader.set("regions", 2);
+		shader.set("tiles", 3);
+	}
+
+	void TilemapRenderer::set_viewport(const glm::vec4& viewport) {
+		shader.set(viewport_, viewport);
+	}
+
+	void TilemapRenderer::update_pages_(std::size_t l, int chunk_x, int chunk_y) {
+		auto&& layer = map.layers[l];
+		const int n = TileLayer::chunk_size;
+
+		int i_end = std::min((chunk_y + 1) * n, layer.height);
+		int j_end = std::min((chunk_x + 1) * n, layer.width);
+
+		std::uint32_t pages = 0;
+		for (int i = chunk_y * n; i < i_end; i++) {
+			for (int j = chunk_x * n; j < j_end; j++) {
+				// tileset ids start at firstgid 1
+				int gid = layer.gid(i, j);
+				if (!gid) continue;
+
+				if (auto region = atlas.find(gid - 1)) pages |= page_bit(region->page);
+				else if (on_missing) on_missing(gid - 1);
+			}
+		}
+
+		layers_[l].pages[chunk_y * layer.chunks_x() + chunk_x] = pages;
+	}
+
+	void TilemapRenderer::upload_(std::size_t l) {
+		PROFILE_ZONE("tilemap upload");
+
+		auto&& layer = map.layers[l];
+		Layer& gpu = layers_[l];
+
+		// integer textures are never filtered
+		gpu.gids.internal_format = GL_R32I;
+		gpu.gids.image_format = GL_RED_INTEGER;
+		gpu.gids.pixel_type = GL_INT;
+		gpu.gids.wrap_s = gpu.gids.wrap_t = GL_CLAMP_TO_EDGE;
+		gpu.gids.filter_min = gpu.gids.filter_mag = GL_NEAREST;
+		gpu.gids.load(layer.width, layer.height, (unsigned char*)layer.gids.data());
+
+		gpu.revisions.resize((std::size_t)layer.chunks_x() * layer.chunks_y());
+		gpu.pages.resize(gpu.revisions.size());
+		for (int y = 0; y < layer.chunks_y(); y++) {
+			for (int x = 0; x < layer.chunks_x(); x++) {
+				gpu.revisions[y * layer.chunks_x() + x] = layer.revision(x, y);
+				update_pages_(l, x, y);
+			}
+		}
+		gpu.uploaded = true;
+	}
+
+	void TilemapRenderer::upload_chunk_(std::size_t l, int chunk_x, int chunk_y) {
+		auto&& layer = map.layers[l];
+		const int n = TileLayer::chunk_size;
+
+		int i_begin = chunk_y * n, i_end = std::min(i_begin + n, layer.height);
+		int j_begin = chunk_x * n, j_end = std::min(j_begin + n, layer.width);
+
+		layers_[l].gids.bind();
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, layer.width);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, j_begin, i_begin, j_end - j_begin, i_end - i_begin,
+		                GL_RED_INTEGER, GL_INT, &layer.gids[(std::size_t)i_begin * layer.width + j_begin]);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+		layers_[l].revisions[chunk_y * layer.chunks_x() + chunk_x] = layer.revision(chunk_x, chunk_y);
+		update_pages_(l, chunk_x, chunk_y);
+	}
+
+	void TilemapRenderer::build_regions_() {
+		PROFILE_ZONE("tilemap regions");
+
+		int ids = 1;
+		for (auto&& tile : map.tiles) ids = std::max(ids, tile.gid + 1);
+		for (auto&& region : atlas.regions) ids = std::max(ids, region.first + 1);
+
+		// tiles without a region are on no page
+		std::vector<glm::vec4> table((std::size_t)ids * 2, glm::vec4(0));
+		for (int id = 0; id < ids; id++) table[ids + id].x = -2;
+
+		for (auto&& region : atlas.regions) {
+			table[region.first] = region.second.uv;
+			table[ids + region.first] = glm::vec4(region.second.page, region.second.slice, 0, 0);
+		}
+
+		regions_.internal_format = GL_RGBA32F;
+		regions_.image_format = GL_RGBA;
+		regions_.pixel_type = GL_FLOAT;
+		regions_.wrap_s = regions_.wrap_t = GL_CLAMP_TO_EDGE;
+		regions_.filter_min = regions_.filter_mag = GL_NEAREST;
+		regions_.load(ids, 2, (unsigned char*)table.data());
+
+		regions_built_ = true;
+		regions_revision_ = atlas.revision;
+
+		// tiles that were missing may be on a new page now
+		for (std::size_t l = 0; l < layers_.size(); l++) {
+			if (!layers_[l].uploaded) continue;
+
+			auto&& layer = map.layers[l];
+			for (int y = 0; y < layer.chunks_y(); y++) {
+				for (int x = 0; x < layer.chunks_x(); x++) update_pages_(l, x, y);
+			}
+		}
+	}
+
+	void TilemapRenderer::draw(std::size_t l, const glm::mat4& projection, const glm::vec4& view) {
+		auto&& layer = map.layers[l];
+		Layer& gpu = layers_[l];
+
+		glm::vec2 tile_size(map.tile_width, map.tile_height);
+		glm::vec4 bounds(0, 0, layer.width * tile_size.x, layer.height * tile_size.y);
+
+		if (!gpu.uploaded) upload_(l);
+		if (!regions_built_ || regions_revision_ != atlas.revision) build_regions_();
+		if (!intersects(view, bounds)) return;
+
+		// Chunks out of view are uploaded once they come into it. A pixel on
+		// the edge of the view may snap to the cell beyond, one more cell
+		// around it is kept up to date.
+		CellRange nearby = map.chunks_in(l, view.x - tile_size.x, view.y - tile_size.y,
+		                                 view.z + tile_size.x, view.w + tile_size.y);
+		for (int y = nearby.row_begin; y < nearby.row_end; y++) {
+			for (int x = nearby.col_begin; x < nearby.col_end; x++) {
+				if (gpu.revisions[y * layer.chunks_x() + x] != layer.revision(x, y)) upload_chunk_(l, x, y);
+			}
+		}
+
+		CellRange visible = map.chunks_in(l, view.x, view.y, view.z, view.w);
+		std::uint32_t pages = 0;
+		for (int y = visible.row_begin; y < visible.row_end; y++) {
+			for (int x = visible.col_begin; x < visible.col_end; x++) pages |= gpu.pages[y * layer.chunks_x() + x];
+		}
+
+		// only the visible part, nothing is shaded off screen
+		glm::vec4 rect(glm::max(glm::vec2(view), glm::vec2(bounds)),
+		               glm::min(glm::vec2(view.z, view.w), glm::vec2(bounds.z, bounds.w)));
+
+		shader.set(projection_, projection);
+		shader.set(rect_, rect);
+		shader.set(tile_size_, tile_size);
+		vao.bind();
+
+		state_cache().active_texture(GL_TEXTURE1);
+		gpu.gids.bind();
+		state_cache().active_texture(GL_TEXTURE2);
+		regions_.bind();
+		state_cache().active_texture(GL_TEXTURE3);
+		atlas.tiles.bind();
+		state_cache().active_texture(GL_TEXTURE0);
+
+		// a sampler cannot be picked per pixel, the tile array and every page
+		// are a draw of their own that keeps the cells on it
+		for (int page = -1; page < (int)atlas.pages.size(); page++) {
+			if (!(pages & page_bit(page))) continue;
+
+			shader.set(page_, page);
+			if (page >= 0) atlas.pages[page].bind();
+			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+			stats.draw_calls++;
+			stats.state_changes++;
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef ALLOCATION_COUNTER_HPP__
+#define ALLOCATION_COUNTER_HPP__
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Allocation counting hook, every global operator new is counted so a tool
+// can report (and assert) heap allocations per frame. It replaces the global
+// operators, include it in one file of the tool only.
+static std::atomic<std::size_t> allocations{0};
+
+void* operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+// C++14 passes the size to this one where it is known, it has to match.
+// The array forms forward to these two.
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+#endif
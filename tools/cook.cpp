@@ -0,0 +1,182 @@
+// Cooks the game's assets into one archive that the game maps at startup
+// instead of opening and decoding every file in res/.
+//
+//   bin/cook res.kpak res xmlova.tmx
+//
+// Directories are searched (not recursively) for assets. PNGs are stored as
+// RGBA8, .glsl shaders as they are and .tmx maps as a .kmap under the same
+// name, so "xmlova.tmx" is found as "xmlova.kmap". Everything else is
+// skipped.
+//
+// Options:
+//   --mips   store every texture with its mip chain
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#include <lodepng.h>
+
+#include <asset_archive.hpp>
+#include <mapped_file.hpp>
+#include <tiled.hpp>
+
+namespace
+{
+	bool ends_with(const std::string& s, const std::string& suffix) {
+		return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	// Files of a directory, sorted so the archive does not depend on the
+	// order the file system lists them in. Empty when it is no directory.
+	std::vector<std::string> list_directory(const std::string& directory) {
+		std::vector<std::string> files;
+
+#ifdef _WIN32
+		WIN32_FIND_DATAA data;
+		HANDLE find = FindFirstFileA((directory + "/*").c_str(), &data);
+		if (find == INVALID_HANDLE_VALUE) return files;
+		do {
+			if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) files.push_back(directory + "/" + data.cFileName);
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+#else
+		DIR* dir = opendir(directory.c_str());
+		if (!dir) return files;
+		while (dirent* entry = readdir(dir)) {
+			std::string path = directory + "/" + entry->d_name;
+			struct stat st;
+			if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) files.push_back(path);
+		}
+		closedir(dir);
+#endif
+
+		std::sort(files.begin(), files.end());
+		return files;
+	}
+
+	bool is_directory(const std::string& path) {
+#ifdef _WIN32
+		DWORD attributes = GetFileAttributesA(path.c_str());
+		return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+#else
+		struct stat st;
+		return stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+#endif
+	}
+
+	std::vector<unsigned char> read_file(const std::string& filename) {
+		std::ifstream in(filename, std::ios::binary);
+		if (!in) {
+			std::cerr << "ERROR: cannot read " << filename << std::endl;
+			throw "cannot read file";
+		}
+		return std::vector<unsigned char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	}
+
+	// Returns false for files that are not cooked.
+	bool cook(const std::string& filename, bool mips, gl::CookedAsset& asset) {
+		// before reading, an edit while cooking makes the entry stale
+		asset.source = filename;
+		asset.source_mtime = file_mtime(filename);
+
+		if (ends_with(filename, ".png")) {
+			std::vector<unsigned char> pixels;
+			unsigned width, height;
+			unsigned error = lodepng::decode(pixels, width, height, filename);
+			if (error) {
+				std::cerr << "ERROR: cannot decode " << filename << ": " << lodepng_error_text(error) << std::endl;
+				throw "cannot decode png";
+			}
+
+			// before the mips, so they average premultiplied colors
+			gl::premultiply_alpha(pixels.data(), pixels.size() / 4);
+
+			asset.name = filename;
+			asset.type = gl::AssetArchive::texture;
+			asset.width = width;
+			asset.height = height;
+			asset.levels = 1;
+			asset.data = mips ? gl::build_mip_chain(pixels, width, height, asset.levels) : std::move(pixels);
+			return true;
+		}
+
+		if (ends_with(filename, ".glsl")) {
+			asset.name = filename;
+			asset.data = read_file(filename);
+			return true;
+		}
+
+		if (ends_with(filename, ".tmx")) {
+			std::ostringstream kmap;
+			save_binary_map(load_tiles(filename), kmap);
+
+			std::string bytes = kmap.str();
+			asset.name = filename.substr(0, filename.size() - 4) + ".kmap";
+			asset.data.assign(bytes.begin(), bytes.end());
+			return true;
+		}
+
+		return false;
+	}
+}
+
+int main(int argc, char** argv) {
+	bool mips = false;
+	std::vector<std::string> inputs;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--mips") mips = true;
+		else inputs.push_back(arg);
+	}
+
+	if (inputs.size() < 2) {
+		std::cerr << "usage: " << argv[0] << " [--mips] output.kpak directory|file..." << std::endl;
+		return 1;
+	}
+
+	try {
+		std::vector<std::string> files;
+		for (std::size_t i = 1; i < inputs.size(); i++) {
+			if (is_directory(inputs[i])) {
+				for (auto&& file : list_directory(inputs[i])) files.push_back(file);
+			} else {
+				files.push_back(inputs[i]);
+			}
+		}
+
+		std::vector<gl::CookedAsset> assets;
+		std::size_t textures = 0, bytes = 0;
+
+		for (auto&& file : files) {
+			gl::CookedAsset asset;
+			if (!cook(file, mips, asset)) continue;
+
+			if (asset.type == gl::AssetArchive::texture) textures++;
+			bytes += asset.data.size();
+			assets.push_back(std::move(asset));
+		}
+
+		gl::save_asset_archive(assets, inputs[0]);
+
+		std::cout << inputs[0] << ": " << assets.size() << " assets (" << textures << " textures), "
+		          << bytes << " bytes before deduplication" << std::endl;
+	} catch (const char* error) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
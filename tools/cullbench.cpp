@@ -0,0 +1,183 @@
+// CPU cost of finding what is on screen in generated square maps of growing
+// size, with the same 800x600 view in the middle of each. No GL, only the
+// queries MapRenderer and the y-sorted layers run every frame. Reports the
+// times as JSON.
+//
+//   bin/cullbench > cull.json
+//
+// Every map is measured four ways, each reports the cells or chunks it
+// touched as "visited":
+//   all_cells      every cell visited, as the game loop did before culling
+//   visible_cells  TileMap::cells_in() and for_each_cell() over the result
+//   chunk_scan     every chunk tested against the view with intersects()
+//   chunk_range    TileMap::chunks_in(), only the chunks in view visited
+//
+// Options:
+//   --frames N   queries per map and way, the mean counts (default 50)
+//   --max N      largest map side in cells, doubling from 256 (default 8192)
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <gl_utils.hpp>
+#include <stopwatch.hpp>
+#include <tiled.hpp>
+
+namespace
+{
+	struct Options
+	{
+		int frames = 50;
+		int max = 8192;
+	};
+
+	Options parse_options(int argc, char** argv) {
+		Options options;
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+
+			if (i + 1 >= argc) {
+				std::cerr << "ERROR: missing value for " << arg << std::endl;
+				throw "missing option value";
+			}
+
+			const char* value = argv[++i];
+
+			if (arg == "--frames") options.frames = std::atoi(value);
+			else if (arg == "--max") options.max = std::atoi(value);
+			else {
+				std::cerr << "ERROR: unknown option " << arg << std::endl;
+				throw "unknown option";
+			}
+		}
+
+		if (options.frames <= 0 || options.max <= 0) {
+			std::cerr << "ERROR: --frames and --max must be positive" << std::endl;
+			throw "invalid option";
+		}
+
+		return options;
+	}
+
+	TileMap generate_map(int size) {
+		TileMap map;
+		map.width = map.height = size;
+		map.tile_width = map.tile_height = 32;
+
+		TileLayer layer;
+		layer.name = "ground";
+		layer.width = layer.height = size;
+		layer.gids = GidView::allocate((std::size_t)size * size);
+		for (std::size_t i = 0; i < layer.gids.size(); i++) layer.gids[i] = (int)(i % 7);
+
+		map.layers.push_back(std::move(layer));
+		return map;
+	}
+
+	// read by nothing, keeps the visits from being optimized away
+	volatile long long sink;
+
+	// Mean microseconds of one query, `visit` returns the cells or chunks
+	// it touched.
+	template <typename F>
+	float mean_us(int frames, long long& visited, F visit) {
+		visited = 0;
+		Stopwatch stopwatch;
+		for (int frame = 0; frame < frames; frame++) visited += visit();
+		float us = (float)stopwatch.us() / frames;
+		visited /= frames;
+		return us;
+	}
+
+	struct Sample
+	{
+		const char* way;
+		float us;
+		long long visited;
+	};
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	try {
+		options = parse_options(argc, argv);
+	} catch (const char* error) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	std::cout
+		<< "{\n"
+		<< "  \"frames\": " << options.frames << ",\n"
+		<< "  \"view\": [800, 600],\n"
+		<< "  \"maps\": [";
+
+	for (int size = 256; size <= options.max; size *= 2) {
+		TileMap map = generate_map(size);
+		const TileLayer& layer = map.layers[0];
+
+		float center = size * 32 / 2.0f;
+		glm::vec4 view(center - 400, center - 300, center + 400, center + 300);
+
+		const int n = TileLayer::chunk_size;
+		glm::vec2 chunk_size(n * map.tile_width, n * map.tile_height);
+
+		std::vector<Sample> samples;
+		long long visited;
+
+		float us = mean_us(options.frames, visited, [&] {
+			long long cells = 0, sum = 0;
+			for (int i = 0; i < layer.height; i++) {
+				for (int j = 0; j < layer.width; j++, cells++) sum += layer.gid(i, j);
+			}
+			sink = sum;
+			return cells;
+		});
+		samples.push_back({ "all_cells", us, visited });
+
+		us = mean_us(options.frames, visited, [&] {
+			long long cells = 0, sum = 0;
+			CellRange range = map.cells_in(0, view.x, view.y, view.z, view.w);
+			map.for_each_cell(0, range, [&](int, int, int gid) { cells++; sum += gid; });
+			sink = sum;
+			return cells;
+		});
+		samples.push_back({ "visible_cells", us, visited });
+
+		us = mean_us(options.frames, visited, [&] {
+			long long chunks = 0, sum = 0;
+			for (int y = 0; y < layer.chunks_y(); y++) {
+				for (int x = 0; x < layer.chunks_x(); x++, chunks++) {
+					glm::vec2 lo = glm::vec2(x, y) * chunk_size;
+					sum += gl::intersects(view, glm::vec4(lo, lo + chunk_size));
+				}
+			}
+			sink = sum;
+			return chunks;
+		});
+		samples.push_back({ "chunk_scan", us, visited });
+
+		us = mean_us(options.frames, visited, [&] {
+			CellRange range = map.chunks_in(0, view.x, view.y, view.z, view.w);
+			long long chunks = 0, sum = 0;
+			for (int y = range.row_begin; y < range.row_end; y++) {
+				for (int x = range.col_begin; x < range.col_end; x++, chunks++) sum += layer.revision(x, y);
+			}
+			sink = sum;
+			return chunks;
+		});
+		samples.push_back({ "chunk_range", us, visited });
+
+		std::cout << (size == 256 ? "\n" : ",\n") << "    {\"size\": " << size;
+		for (auto&& sample : samples) {
+			std::cout << ", \"" << sample.way << "\": {\"us\": " << sample.us << ", \"visited\": " << sample.visited << "}";
+		}
+		std::cout << "}";
+	}
+
+	std::cout << "\n  ]\n}" << std::endl;
+	return 0;
+}
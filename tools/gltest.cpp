@@ -0,0 +1,479 @@
+// Tests of the GL wrappers in gl_utils on a surfaceless EGL context (see
+// headless_context.hpp). The glad entry points the tests care about are
+// replaced by shims that count their calls, so a test can assert which GL
+// calls a wrapper actually made.
+//
+//   bin/gltest     (or `make test`), exits with 1 when a check failed
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <gl_utils.hpp>
+#include <map_renderer.hpp>
+#include <mapped_file.hpp>
+#include <profiler.hpp>
+#include <scene.hpp>
+#include <tilemap_renderer.hpp>
+
+#include "allocation_counter.hpp"
+#include "headless_context.hpp"
+
+namespace
+{
+	int failures = 0;
+
+	void check(bool passed, const char* expression, const char* file, int line) {
+		if (passed) return;
+
+		std::cerr << "ERROR: " << file << ":" << line << ": check failed: " << expression << std::endl;
+		failures++;
+	}
+
+	#define CHECK(expression) check((expression), #expression, __FILE__, __LINE__)
+
+	struct CallCounts
+	{
+		int bind_texture = 0;
+		int use_program = 0;
+		int get_uniform_location = 0;
+	};
+
+	CallCounts calls;
+
+	PFNGLBINDTEXTUREPROC real_bind_texture;
+	PFNGLUSEPROGRAMPROC real_use_program;
+	PFNGLGETUNIFORMLOCATIONPROC real_get_uniform_location;
+
+	void APIENTRY count_bind_texture(GLenum target, GLuint texture) {
+		calls.bind_texture++;
+		real_bind_texture(target, texture);
+	}
+
+	void APIENTRY count_use_program(GLuint program) {
+		calls.use_program++;
+		real_use_program(program);
+	}
+
+	GLint APIENTRY count_get_uniform_location(GLuint program, const GLchar* name) {
+		calls.get_uniform_location++;
+		return real_get_uniform_location(program, name);
+	}
+
+	void install_shims() {
+		real_bind_texture = glad_glBindTexture;
+		real_use_program = glad_glUseProgram;
+		real_get_uniform_location = glad_glGetUniformLocation;
+
+		glad_glBindTexture = count_bind_texture;
+		glad_glUseProgram = count_use_program;
+		glad_glGetUniformLocation = count_get_uniform_location;
+	}
+
+	// Shader::set() and the binds of Shader and Texture2D go through
+	// StateCache, which only calls GL when the bound object changes.
+	void test_state_cache() {
+		gl::Shader shader("res/sprite");
+		unsigned char texel[4] = { 255, 255, 255, 255 };
+		gl::Texture2D a, b;
+		a.load(1, 1, texel);
+		b.load(1, 1, texel);
+
+		gl::state_cache().invalidate();
+		gl::state_cache().reset_counters();
+		calls = CallCounts();
+
+		for (int i = 0; i < 100; i++) {
+			shader.use();
+			shader.set("image", 0);
+			a.bind();
+		}
+
+		CHECK(calls.use_program == 1);
+		CHECK(calls.bind_texture == 1);
+		CHECK(calls.get_uniform_location == 0);
+		// the program, the texture and texture unit 0, which was unknown
+		CHECK(gl::state_cache().binds_issued == 3);
+		// 200 uses (one by every set()) and 100 binds
+		CHECK(gl::state_cache().binds_elided == 298);
+
+		// a different texture is bound every time
+		calls = CallCounts();
+		for (int i = 0; i < 10; i++) {
+			b.bind();
+			a.bind();
+		}
+		CHECK(calls.bind_texture == 20);
+
+		// and after invalidate() nothing is assumed about the GL state
+		calls = CallCounts();
+		gl::state_cache().invalidate();
+		a.bind();
+		shader.use();
+		CHECK(calls.bind_texture == 1);
+		CHECK(calls.use_program == 1);
+	}
+
+	// Every segment a write spans is fenced once the ring moves past it, not
+	// just the one the write ended in.
+	void test_stream_buffer_fences() {
+		const GLsizeiptr size = 4096, segment = size / gl::StreamBuffer::segment_count;
+		gl::StreamBuffer ring(size);
+		if (!ring.persistent()) {
+			std::cout << "skipped stream buffer fences, no GL_ARB_buffer_storage" << std::endl;
+			return;
+		}
+
+		std::vector<unsigned char> payload(size, 7);
+
+		// segments 0 to 2, then on into 3
+		CHECK(ring.write(payload.data(), 2 * segment + segment / 2) == 0);
+		ring.write(payload.data(), segment);
+		for (int i = 0; i < gl::StreamBuffer::segment_count; i++) CHECK(!ring.fenced(i));
+
+		// wraps around: all four are fenced, then 0 is waited for and reused
+		CHECK(ring.write(payload.data(), segment) == 0);
+		CHECK(!ring.fenced(0));
+		for (int i = 1; i < gl::StreamBuffer::segment_count; i++) CHECK(ring.fenced(i));
+
+		// a payload over the rest of the ring fences 0, which it leaves, and
+		// waits for each segment it spans
+		CHECK(ring.write(payload.data(), size - segment) == segment);
+		CHECK(ring.fenced(0));
+		for (int i = 1; i < gl::StreamBuffer::segment_count; i++) CHECK(!ring.fenced(i));
+	}
+
+	// Growing a tile array keeps every level of the layers it had.
+	void test_texture_array_resize() {
+		const GLuint size = 4, levels = 3, layers = 2;
+		std::size_t layer_size = gl::mip_chain_size(size, size, levels);
+
+		std::vector<unsigned char> data(layer_size * layers);
+		for (std::size_t i = 0; i < data.size(); i++) data[i] = (unsigned char)(i / 4 * 4 % 251 + i % 4);
+
+		gl::Texture2DArray array;
+		array.load(size, size, layers, levels, data.data());
+		GLuint old = array.id;
+
+		array.resize(5);
+		CHECK(array.layers == 5);
+		CHECK(array.id != old);
+
+		array.bind();
+		// of the level in each mip chain
+		std::size_t offset = 0;
+		for (GLuint level = 0; level < levels; level++) {
+			GLuint w = std::max(1u, size >> level), h = std::max(1u, size >> level);
+			std::size_t bytes = (std::size_t)w * h * 4;
+			std::vector<unsigned char> pixels(bytes * array.layers);
+			glGetTexImage(GL_TEXTURE_2D_ARRAY, level, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+			for (GLuint layer = 0; layer < layers; layer++) {
+				const unsigned char* chain = data.data() + layer * layer_size + offset;
+				CHECK(std::equal(chain, chain + bytes, pixels.begin() + layer * bytes));
+			}
+			offset += bytes;
+		}
+
+		// an array that was never loaded has nothing to copy
+		gl::Texture2DArray empty;
+		empty.width = empty.height = size;
+		empty.levels = levels;
+		empty.resize(2);
+		CHECK(empty.layers == 2);
+		CHECK(glGetError() == GL_NO_ERROR);
+
+		empty.load_layer(1, data.data());
+		empty.bind();
+		std::vector<unsigned char> pixels(size * size * 4 * 2);
+		glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		CHECK(std::equal(data.begin(), data.begin() + size * size * 4, pixels.begin() + size * size * 4));
+	}
+
+	// RGBA of the pixel at (x, y) of the framebuffer.
+	std::vector<unsigned char> read_pixel(int x, int y) {
+		std::vector<unsigned char> pixel(4);
+		glReadPixels(x, y, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixel.data());
+		return pixel;
+	}
+
+	// Triangles and quads of a Batch are drawn by z, at the same z in the
+	// order they were pushed, although they go through different draws.
+	void test_batch_order() {
+		const int size = 64;
+		glViewport(0, 0, size, size);
+
+		gl::Shader shader(gl::Vertex::shader_name());
+		shader.set("projection", glm::ortho(0.0f, (float)size, (float)size, 0.0f, -1.0f, 1.0f));
+		gl::VAO vao;
+		gl::StreamBuffer stream(1 << 16);
+		stream.bind();
+		gl::Vertex::setup_attributes();
+
+		glm::vec2 center(size / 2, size / 2);
+		gl::ColorTex red(1, 0, 0, 1), green(0, 1, 0, 1), blue(0, 0, 1, 1);
+
+		// each covers the whole framebuffer
+		gl::Batch batch;
+		batch.push_quad(center, size, size, 0, red);
+		batch.push_triangle({ 0, 0 }, { 2 * size, 0 }, { 0, 2 * size }, 0, green);
+		batch.push_quad(center, size, size, 0, blue);
+
+		glClear(GL_COLOR_BUFFER_BIT);
+		CHECK(batch.draw(stream) == 3);
+		CHECK(read_pixel(size / 2, size / 2) == std::vector<unsigned char>({ 0, 0, 255, 255 }));
+
+		// a higher z wins over the push order
+		batch.clear();
+		batch.push_triangle({ 0, 0 }, { 2 * size, 0 }, { 0, 2 * size }, 0.5f, green);
+		batch.push_quad(center, size, size, 0, red);
+
+		glClear(GL_COLOR_BUFFER_BIT);
+		CHECK(batch.draw(stream) == 2);
+		CHECK(read_pixel(size / 2, size / 2) == std::vector<unsigned char>({ 0, 255, 0, 255 }));
+	}
+
+	// Cells of y-sorted layers in the same row have the same depth, the map
+	// order and not the texture names decides which one is on top. The
+	// textures are created so that sorting by name would get it wrong.
+	void test_map_layer_order() {
+		const int size = 64;
+		// a context without a surface starts with an empty viewport
+		glViewport(0, 0, size, size);
+		gl::Shader shader("res/sprite");
+		shader.set("projection", glm::ortho(0.0f, (float)size, (float)size, 0.0f, -1.0f, 1.0f));
+		gl::SpriteRenderer sprites(shader);
+
+		unsigned char blue[4] = { 0, 0, 255, 255 }, green[4] = { 0, 255, 0, 255 }, red[4] = { 255, 0, 0, 255 };
+		gl::Texture2D player;
+		player.load(1, 1, blue);
+
+		// one cell of the size of the framebuffer, the ground is empty
+		TileMap map;
+		map.width = map.height = 1;
+		map.tile_width = map.tile_height = size;
+		for (int l = 0; l < 3; l++) {
+			TileLayer layer;
+			layer.width = layer.height = 1;
+			layer.gids = GidView::allocate(1);
+			map.layers.push_back(std::move(layer));
+		}
+		map.set_gid(1, 0, 0, 1);
+		map.set_gid(2, 0, 0, 2);
+
+		// the decoration on layer 2 gets the lower texture name
+		gl::TextureAtlas atlas;
+		atlas.pages.resize(2);
+		atlas.pages[0].load(1, 1, green);
+		atlas.pages[1].load(1, 1, red);
+		atlas.regions[0] = { 1, 0, 0, 0, 1, 1, glm::vec4(0, 0, 1, 1) };
+		atlas.regions[1] = { 0, 0, 0, 0, 1, 1, glm::vec4(0, 0, 1, 1) };
+
+		gl::MapRenderer renderer(sprites, map, atlas);
+		renderer.set_y_sorted(1);
+		renderer.set_y_sorted(2);
+		glm::vec4 view(0, 0, size, size);
+
+		glClear(GL_COLOR_BUFFER_BIT);
+		sprites.begin();
+		renderer.draw(view);
+		sprites.end();
+		CHECK(read_pixel(size / 2, size / 2) == std::vector<unsigned char>({ 0, 255, 0, 255 }));
+
+		// the player stands in the same row, its texture is the oldest
+		glClear(GL_COLOR_BUFFER_BIT);
+		sprites.begin();
+		renderer.draw(view);
+		sprites.set_layer(renderer.sort_layer, true, renderer.sprite_order());
+		sprites.draw_sprite(player, glm::vec2(0, 0), glm::vec2(size, size));
+		sprites.end();
+		CHECK(read_pixel(size / 2, size / 2) == std::vector<unsigned char>({ 0, 0, 255, 255 }));
+
+		// a static layer above a y-sorted one covers it
+		renderer.set_y_sorted(2, false);
+		glClear(GL_COLOR_BUFFER_BIT);
+		sprites.begin();
+		renderer.draw(view);
+		sprites.end();
+		CHECK(read_pixel(size / 2, size / 2) == std::vector<unsigned char>({ 0, 255, 0, 255 }));
+	}
+
+	std::vector<unsigned char> read_framebuffer(int width, int height) {
+		std::vector<unsigned char> pixels((std::size_t)width * height * 4);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+		return pixels;
+	}
+
+	// TilemapRenderer draws the pixels MapRenderer draws. The zooms and
+	// offsets put cell edges on pixel centers, where the shader has to pick
+	// the cell the rasterizer picks for the sprite quads, and between them.
+	// Both sample the same texels of the same tile, only the linear filter
+	// weights may round differently, by at most 2 per channel in well under
+	// 1% of the channels.
+	void test_tilemap_matches_sprites(bool tile_array) {
+		const int size = 64, tile = 16, tiles = 3;
+		glViewport(0, 0, size, size);
+
+		TileMap map;
+		map.width = 10;
+		map.height = 8;
+		map.tile_width = map.tile_height = tile;
+		for (int id = 0; id < tiles; id++) map.tiles.push_back({ id, tile, tile, {} });
+
+		TileLayer layer;
+		layer.width = map.width;
+		layer.height = map.height;
+		layer.gids = GidView::allocate((std::size_t)map.width * map.height);
+		for (int i = 0; i < map.height; i++) {
+			for (int j = 0; j < map.width; j++) layer.gids[i * map.width + j] = (i * 7 + j * 3) % (tiles + 1);
+		}
+		map.layers.push_back(std::move(layer));
+
+		// gradients, so a texel from the wrong place or tile shows
+		gl::AtlasBuilder builder;
+		if (tile_array) builder.tile_width = builder.tile_height = tile;
+		for (int id = 0; id < tiles; id++) {
+			std::vector<unsigned char> pixels(tile * tile * 4);
+			for (int y = 0; y < tile; y++) {
+				for (int x = 0; x < tile; x++) {
+					unsigned char* p = &pixels[(y * tile + x) * 4];
+					p[0] = (unsigned char)(x * 255 / (tile - 1));
+					p[1] = (unsigned char)(y * 255 / (tile - 1));
+					p[2] = (unsigned char)(id * 100);
+					p[3] = 255;
+				}
+			}
+			builder.add(id, tile, tile, std::move(pixels));
+		}
+		builder.pack();
+
+		gl::TextureAtlas atlas;
+		atlas.load(builder);
+
+		gl::Shader sprite_shader("res/sprite");
+		gl::SpriteRenderer sprites(sprite_shader);
+		gl::MapRenderer map_renderer(sprites, map, atlas);
+		gl::TilemapRenderer tilemap(map, atlas);
+		tilemap.set_viewport(glm::vec4(0, 0, size, size));
+
+		glm::vec4 view(0, 0, map.width * tile, map.height * tile);
+		const glm::vec3 transforms[] = {
+			// zoom, offset x and y in pixels
+			{ 1.0f, 0.5f, 0.5f },
+			{ 0.5f, 0.5f, -0.5f },
+			{ 1.5f, 0.5f, 0.5f },
+			{ 1.25f, -0.5f, 0.5f },
+			{ 1.37f, -5.3f, -3.7f },
+		};
+
+		for (auto&& transform : transforms) {
+			glm::mat4 projection = glm::ortho(0.0f, (float)size, (float)size, 0.0f, -1.0f, 1.0f);
+			projection = glm::translate(projection, glm::vec3(transform.y, transform.z, 0));
+			projection = glm::scale(projection, glm::vec3(transform.x, transform.x, 1));
+			sprite_shader.set("projection", projection);
+
+			glClear(GL_COLOR_BUFFER_BIT);
+			map_renderer.draw(view);
+			std::vector<unsigned char> expected = read_framebuffer(size, size);
+
+			glClear(GL_COLOR_BUFFER_BIT);
+			tilemap.draw(0, projection, view);
+			std::vector<unsigned char> pixels = read_framebuffer(size, size);
+
+			int max_difference = 0;
+			std::size_t differences = 0;
+			for (std::size_t i = 0; i < pixels.size(); i++) {
+				int difference = std::abs((int)pixels[i] - (int)expected[i]);
+				max_difference = std::max(max_difference, difference);
+				differences += difference > 0;
+			}
+			CHECK(max_difference <= 2);
+			CHECK(differences * 100 < pixels.size());
+		}
+	}
+
+	// Once every tile is in the atlas and the loader is idle, a frame of the
+	// game scene makes no heap allocations, cell edits included. Frames that
+	// load a tile first used after loading allocate, see tools/headless.cpp.
+	void test_scene_frames_allocate_nothing() {
+		const int size = 64, frames = 120;
+
+		Scene scene("xmlova", size, size, 0, "");
+		TileMap& map = scene.map;
+		CHECK(!map.tiles.empty() && !map.layers.empty());
+		if (map.tiles.empty() || map.layers.empty()) return;
+
+		// a cell on screen, the edits below rebuild its chunk
+		scene.draw();
+		PROFILE_FRAME();
+		glm::vec4 view = scene.view();
+		int i = std::min(std::max((int)view.y / map.tile_height + 1, 0), map.height - 1);
+		int j = std::min(std::max((int)view.x / map.tile_width + 1, 0), map.width - 1);
+
+		// every tile drawn once, so the edits find them all in the atlas
+		std::vector<int> gids;
+		for (auto&& tile : map.tiles) {
+			if (file_mtime("res/" + tile.filename) < 0) continue;
+
+			// Tile::gid is the tileset id, cells hold firstgid 1 + id
+			gids.push_back(tile.gid + 1);
+			map.set_gid(0, i, j, gids.back());
+			for (int frame = 0; frame < 100; frame++) {
+				scene.draw();
+				PROFILE_FRAME();
+				if (scene.tiles_loading() == 0) break;
+			}
+		}
+		CHECK(scene.tiles_loading() == 0);
+		CHECK(!gids.empty());
+		if (gids.empty()) return;
+		glFinish();
+
+		std::size_t allocations_before = allocations.load();
+		unsigned atlas_revision = scene.atlas.revision;
+
+		for (int frame = 0; frame < frames; frame++) {
+			scene.player_x = frame / 4 % 4;
+			scene.player_y = frame / 16 % 4;
+
+			if (frame % 2 == 0) map.set_gid(0, i, j, gids[frame / 2 % gids.size()]);
+			scene.draw();
+			PROFILE_FRAME();
+		}
+		glFinish();
+
+		CHECK(allocations.load() - allocations_before == 0);
+		CHECK(scene.tiles_loading() == 0);
+		CHECK(scene.atlas.revision == atlas_revision);
+	}
+}
+
+int main() {
+	try {
+		HeadlessContext context(64, 64);
+		install_shims();
+
+		test_state_cache();
+		test_stream_buffer_fences();
+		test_texture_array_resize();
+		test_batch_order();
+		test_map_layer_order();
+		test_tilemap_matches_sprites(true);
+		test_tilemap_matches_sprites(false);
+		test_scene_frames_allocate_nothing();
+	} catch (const char* error) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	if (failures > 0) {
+		std::cerr << failures << " checks failed" << std::endl;
+		return 1;
+	}
+
+	std::cout << "all tests passed" << std::endl;
+	return 0;
+}
@@ -0,0 +1,380 @@
+// Renders a scripted scene without a window and reports the frame cost as
+// JSON, so rendering regressions can be measured on machines without a GPU
+// (Mesa's llvmpipe through a surfaceless EGL context).
+//
+//   bin/headless --frames 600 --sprites 2000 > frames.json
+//
+// Options:
+//   --frames N       frames to render (default 600)
+//   --warmup N       frames rendered before measuring (default 30)
+//   --map NAME       map without extension (default xmlova)
+//   --width W        framebuffer size (default 800x600)
+//   --height H
+//   --sprites N      extra batched sprites drawn each frame (default 0)
+//   --trace FILE     Chrome trace of the measured frames (profiler builds)
+//   --spike-ms MS    dump spike_<frame>.json around frames slower than MS
+//   --batch-quads N  also time filling and uploading a gl::Batch and a
+//                    gl::PackedBatch of N quads (default 0, skipped)
+//   --decode-threads N
+//                    PNG decode threads while loading, 0 decodes serially
+//                    (default: one less than the hardware threads)
+//   --archive FILE   cooked assets (default res.kpak, see `make cook`), an
+//                    empty name loads the loose files
+//   --tilemap-shader draw the ground with gl::TilemapRenderer instead of
+//                    per-cell sprites
+//   --assert-no-alloc
+//                    exit with 1 when a measured frame allocated memory,
+//                    frames loading a tile on first use excepted
+//
+// Streaming frames are exempt because a tile first drawn after loading is
+// decoded and added to the atlas, which allocates. `--frames 60 --sprites 200`
+// streams in 12 of the 60 frames (18 without res.kpak), each making up to
+// about 120 allocations, 2.4 a frame on average. Every other frame makes none,
+// bin/gltest checks that on a warmed up scene.
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <scene.hpp>
+#include <profiler.hpp>
+#include <stopwatch.hpp>
+
+#include "allocation_counter.hpp"
+#include "headless_context.hpp"
+
+namespace
+{
+	struct Options
+	{
+		int frames = 600;
+		int warmup = 30;
+		std::string map = "xmlova";
+		int width = 800;
+		int height = 600;
+		int sprites = 0;
+		std::string trace;
+		float spike_ms = 0;
+		int batch_quads = 0;
+		int decode_threads = -1;
+		std::string archive = "res.kpak";
+		bool tilemap_shader = false;
+		bool assert_no_alloc = false;
+	};
+
+	Options parse_options(int argc, char** argv) {
+		Options options;
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+
+			if (arg == "--assert-no-alloc") {
+				options.assert_no_alloc = true;
+				continue;
+			}
+			if (arg == "--tilemap-shader") {
+				options.tilemap_shader = true;
+				continue;
+			}
+
+			if (i + 1 >= argc) {
+				std::cerr << "ERROR: missing value for " << arg << std::endl;
+				throw "missing option value";
+			}
+
+			const char* value = argv[++i];
+
+			if (arg == "--frames") options.frames = std::atoi(value);
+			else if (arg == "--warmup") options.warmup = std::atoi(value);
+			else if (arg == "--map") options.map = value;
+			else if (arg == "--width") options.width = std::atoi(value);
+			else if (arg == "--height") options.height = std::atoi(value);
+			else if (arg == "--sprites") options.sprites = std::atoi(value);
+			else if (arg == "--trace") options.trace = value;
+			else if (arg == "--spike-ms") options.spike_ms = (float)std::atof(value);
+			else if (arg == "--batch-quads") options.batch_quads = std::atoi(value);
+			else if (arg == "--decode-threads") options.decode_threads = std::atoi(value);
+			else if (arg == "--archive") options.archive = value;
+			else {
+				std::cerr << "ERROR: unknown option " << arg << std::endl;
+				throw "unknown option";
+			}
+		}
+
+		if (options.frames <= 0 || options.width <= 0 || options.height <= 0) {
+			std::cerr << "ERROR: --frames, --width and --height must be positive" << std::endl;
+			throw "invalid option";
+		}
+
+		return options;
+	}
+
+	struct FrameSample
+	{
+		float ms;
+		gl::RenderStats stats;
+		int binds_issued;
+		int binds_elided;
+		std::size_t allocations;
+		// a tile was loaded on first use, which allocates
+		bool streaming;
+	};
+
+	// Deterministic stand-in for the player: walks around the map, zooms in and
+	// out and edits a tile now and then so chunk rebuilds are part of the cost.
+	void script_frame(Scene& scene, int frame) {
+		int side = frame / 120 % 4;
+		if (frame % 4 == 0) {
+			switch (side) {
+			case 0: scene.player_x++; break;
+			case 1: scene.player_y++; break;
+			case 2: scene.player_x--; break;
+			case 3: scene.player_y--; break;
+			}
+		}
+
+		if (frame % 60 == 0) {
+			scene.camera.scroll(frame / 300 % 2 ? -1 : 1);
+		}
+
+		TileMap& map = scene.map;
+		if (frame % 10 == 0 && !map.tiles.empty() && map.width > 0 && map.height > 0) {
+			int i = (frame * 7) % map.height;
+			int j = (frame * 13) % map.width;
+			// Tile::gid is the tileset id, cells hold firstgid 1 + id
+			map.set_gid(0, i, j, map.tiles[frame % map.tiles.size()].gid + 1);
+		}
+	}
+
+	void draw_extra_sprites(Scene& scene, int count, int frame) {
+		if (count == 0) return;
+
+		const float tile = (float)scene.map.tile_width;
+		const int columns = std::max(1, scene.map.width);
+
+		scene.sprites.begin();
+		// y-sorted like characters
+		scene.sprites.set_layer(scene.map_renderer.sort_layer, true, scene.map_renderer.sprite_order());
+		for (int k = 0; k < count; k++) {
+			float x = (float)((k + frame) % columns) * tile;
+			float y = (float)(k / columns % std::max(1, scene.map.height)) * tile;
+			scene.sprites.draw_sprite(*scene.player, glm::vec2(x, y), glm::vec2(tile), glm::vec3(1.0f, 0.8f, 0.8f));
+		}
+		scene.sprites.end();
+	}
+
+	struct BatchSample
+	{
+		const char* layout;
+		size_t vertex_size;
+		float fill_ms;
+		float upload_ms;
+		float upload_mb_s;
+	};
+
+	// CPU cost of building `quads` quads, then of copying them into a stream
+	// buffer (glFinish included), averaged over `rounds` rounds.
+	template <typename B>
+	BatchSample bench_batch(const char* layout, int quads, int rounds) {
+		using V = typename B::vertex_type;
+		const GLsizeiptr bytes = (GLsizeiptr)quads * 4 * sizeof(V);
+
+		gl::StreamBuffer stream(bytes * 4);
+		B batch;
+
+		float fill_ms = 0, upload_ms = 0;
+		for (int round = 0; round < rounds; round++) {
+			Stopwatch fill;
+			batch.clear();
+			for (int k = 0; k < quads; k++) {
+				glm::vec2 pos((float)(k % 256) * 32.0f, (float)(k / 256) * 32.0f);
+				if (k % 2) {
+					batch.push_quad_bot_left(pos, 32, 32, 0, gl::ColorTex(0.0f, 0.0f));
+				} else {
+					batch.push_quad_bot_left(pos, 32, 32, 0, gl::ColorTex(0.2f, 0.6f, 0.9f, 1.0f));
+				}
+			}
+			fill_ms += fill.ms_float();
+
+			Stopwatch upload;
+			stream.write(batch.quad_vertices.data(), bytes, sizeof(V));
+			glFinish();
+			upload_ms += upload.ms_float();
+		}
+
+		BatchSample sample;
+		sample.layout = layout;
+		sample.vertex_size = sizeof(V);
+		sample.fill_ms = fill_ms / rounds;
+		sample.upload_ms = upload_ms / rounds;
+		sample.upload_mb_s = sample.upload_ms > 0 ? bytes / (sample.upload_ms * 1000.0f) : 0;
+		return sample;
+	}
+
+	float percentile(const std::vector<float>& sorted, float p) {
+		size_t index = (size_t)(p * (sorted.size() - 1) + 0.5f);
+		return sorted[std::min(index, sorted.size() - 1)];
+	}
+
+	void print_json(const Options& options, const std::string& renderer, float load_ms,
+		const std::vector<FrameSample>& samples, const std::vector<BatchSample>& batches,
+		const gl::AssetManager::Stats& assets, const gl::TextureAtlas& atlas) {
+		std::vector<float> times;
+		double total_ms = 0;
+		double draw_calls = 0, state_changes = 0, binds_issued = 0, binds_elided = 0, allocs = 0;
+		std::size_t max_allocs = 0;
+		int streaming = 0;
+
+		for (auto&& sample : samples) {
+			times.push_back(sample.ms);
+			total_ms += sample.ms;
+			draw_calls += sample.stats.draw_calls;
+			state_changes += sample.stats.state_changes;
+			binds_issued += sample.binds_issued;
+			binds_elided += sample.binds_elided;
+			allocs += sample.allocations;
+			max_allocs = std::max(max_allocs, sample.allocations);
+			streaming += sample.streaming;
+		}
+		std::sort(times.begin(), times.end());
+
+		double n = (double)samples.size();
+
+		std::cout
+			<< "{\n"
+			<< "  \"renderer\": \"" << renderer << "\",\n"
+			<< "  \"map\": \"" << options.map << "\",\n"
+			<< "  \"archive\": \"" << options.archive << "\",\n"
+			<< "  \"tilemap_shader\": " << (options.tilemap_shader ? "true" : "false") << ",\n"
+			<< "  \"width\": " << options.width << ",\n"
+			<< "  \"height\": " << options.height << ",\n"
+			<< "  \"sprites\": " << options.sprites << ",\n"
+			<< "  \"load_ms\": " << load_ms << ",\n"
+			<< "  \"frames\": " << samples.size() << ",\n"
+			<< "  \"frame_ms\": {\n"
+			<< "    \"min\": " << times.front() << ",\n"
+			<< "    \"p50\": " << percentile(times, 0.50f) << ",\n"
+			<< "    \"p90\": " << percentile(times, 0.90f) << ",\n"
+			<< "    \"p99\": " << percentile(times, 0.99f) << ",\n"
+			<< "    \"max\": " << times.back() << ",\n"
+			<< "    \"mean\": " << total_ms / n << "\n"
+			<< "  },\n"
+			<< "  \"per_frame\": {\n"
+			<< "    \"draw_calls\": " << draw_calls / n << ",\n"
+			<< "    \"state_changes\": " << state_changes / n << ",\n"
+			<< "    \"binds_issued\": " << binds_issued / n << ",\n"
+			<< "    \"binds_elided\": " << binds_elided / n << ",\n"
+			<< "    \"allocations\": " << allocs / n << ",\n"
+			<< "    \"max_allocations\": " << max_allocs << ",\n"
+			<< "    \"streaming_frames\": " << streaming << "\n"
+			<< "  },\n"
+			<< "  \"assets\": {\n"
+			<< "    \"textures\": " << assets.textures << ",\n"
+			<< "    \"resident\": " << assets.resident << ",\n"
+			<< "    \"cpu_bytes\": " << assets.cpu_bytes << ",\n"
+			<< "    \"gpu_bytes\": " << assets.gpu_bytes << ",\n"
+			<< "    \"path_hits\": " << assets.path_hits << ",\n"
+			<< "    \"content_hits\": " << assets.content_hits << ",\n"
+			<< "    \"evictions\": " << assets.evictions << "\n"
+			<< "  },\n"
+			<< "  \"atlas\": {\n"
+			<< "    \"tiles\": " << atlas.regions.size() << ",\n"
+			<< "    \"pages\": " << atlas.pages.size() << ",\n"
+			<< "    \"array_layers\": " << atlas.tiles.layers << ",\n"
+			<< "    \"gpu_bytes\": " << atlas.gpu_bytes() << "\n"
+			<< "  }";
+
+		if (!batches.empty()) {
+			std::cout << ",\n  \"batch\": {\n    \"quads\": " << options.batch_quads;
+			for (auto&& batch : batches) {
+				std::cout
+					<< ",\n    \"" << batch.layout << "\": {"
+					<< "\"vertex_bytes\": " << batch.vertex_size
+					<< ", \"fill_ms\": " << batch.fill_ms
+					<< ", \"upload_ms\": " << batch.upload_ms
+					<< ", \"upload_mb_s\": " << batch.upload_mb_s << "}";
+			}
+			std::cout << "\n  }";
+		}
+
+		std::cout << "\n}" << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	try {
+		Options options = parse_options(argc, argv);
+
+		HeadlessContext context(options.width, options.height);
+
+		Stopwatch load;
+		unsigned decode_threads = options.decode_threads < 0
+			? gl::TextureLoader::default_threads() : (unsigned)options.decode_threads;
+		Scene scene(options.map, options.width, options.height, decode_threads, options.archive);
+		scene.tilemap_shader = options.tilemap_shader;
+		float load_ms = load.ms_float();
+
+		std::vector<FrameSample> samples;
+		samples.reserve(options.frames);
+
+		if (options.spike_ms > 0) {
+			PROFILE_SPIKE_BUDGET(options.spike_ms, 120);
+		}
+
+		for (int frame = 0; frame < options.warmup + options.frames; frame++) {
+			std::size_t allocations_before = allocations.load();
+			unsigned atlas_revision = scene.atlas.revision;
+			bool tiles_loading = scene.tiles_loading() > 0;
+			Stopwatch stopwatch;
+
+			script_frame(scene, frame);
+			scene.draw();
+			draw_extra_sprites(scene, options.sprites, frame);
+
+			// without a swap nothing waits for the GPU, the frame ends when it is drawn
+			glFinish();
+			PROFILE_FRAME();
+
+			if (frame < options.warmup) continue;
+
+			FrameSample sample;
+			sample.ms = stopwatch.ms_float();
+			sample.stats = scene.sprites.stats;
+			sample.stats += scene.tilemap.stats;
+			sample.binds_issued = gl::state_cache().binds_issued;
+			sample.binds_elided = gl::state_cache().binds_elided;
+			sample.allocations = allocations.load() - allocations_before;
+			sample.streaming = tiles_loading || scene.tiles_loading() > 0 || scene.atlas.revision != atlas_revision;
+			samples.push_back(sample);
+		}
+
+		if (!options.trace.empty() && !PROFILE_WRITE_TRACE(options.trace, options.frames)) {
+			std::cerr << "ERROR: no trace written, build with -DKURATKO_PROFILER" << std::endl;
+		}
+
+		std::vector<BatchSample> batches;
+		if (options.batch_quads > 0) {
+			batches.push_back(bench_batch<gl::Batch>("vertex", options.batch_quads, 50));
+			batches.push_back(bench_batch<gl::PackedBatch>("packed", options.batch_quads, 50));
+		}
+
+		print_json(options, context.renderer(), load_ms, samples, batches, scene.assets.stats(), scene.atlas);
+
+		if (options.assert_no_alloc) {
+			for (auto&& sample : samples) {
+				if (sample.allocations > 0 && !sample.streaming) {
+					std::cerr << "ERROR: a measured frame made " << sample.allocations << " heap allocations" << std::endl;
+					return 1;
+				}
+			}
+		}
+	} catch (const char* error) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,94 @@
+#ifndef HEADLESS_CONTEXT_HPP__
+#define HEADLESS_CONTEXT_HPP__
+
+#include <iostream>
+#include <string>
+
+#include <glad/glad.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <gl_utils.hpp>
+
+// GL 4.1 core context without any surface, everything is drawn into an FBO.
+class HeadlessContext
+{
+	EGLDisplay display_ = EGL_NO_DISPLAY;
+	EGLContext context_ = EGL_NO_CONTEXT;
+	GLuint fbo_ = 0;
+	GLuint color_ = 0;
+public:
+	HeadlessContext(int width, int height) {
+		auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+		if (get_platform_display) {
+			display_ = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+		}
+		if (display_ == EGL_NO_DISPLAY) {
+			display_ = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		}
+
+		EGLint major, minor;
+		if (display_ == EGL_NO_DISPLAY || !eglInitialize(display_, &major, &minor)) {
+			std::cerr << "ERROR: eglInitialize failed" << std::endl;
+			throw "eglInitialize failed";
+		}
+
+		if (!eglBindAPI(EGL_OPENGL_API)) {
+			std::cerr << "ERROR: EGL has no desktop OpenGL" << std::endl;
+			throw "eglBindAPI failed";
+		}
+
+		// same version as the SDL window in main.cpp
+		const EGLint attributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 1,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+
+		context_ = eglCreateContext(display_, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+		if (context_ == EGL_NO_CONTEXT ||
+			!eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, context_)) {
+			std::cerr << "ERROR: failed to create a surfaceless GL 4.1 context" << std::endl;
+			throw "eglCreateContext failed";
+		}
+
+		if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress)) {
+			std::cerr << "ERROR: Failed to initialize GLAD" << std::endl;
+			throw "gladLoadGLLoader failed";
+		}
+		gl::load_extensions((GLADloadproc)eglGetProcAddress);
+
+		glGenTextures(1, &color_);
+		glBindTexture(GL_TEXTURE_2D, color_);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenFramebuffers(1, &fbo_);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo_);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_, 0);
+
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+			std::cerr << "ERROR: headless framebuffer is incomplete" << std::endl;
+			throw "incomplete framebuffer";
+		}
+	}
+
+	~HeadlessContext() {
+		glDeleteFramebuffers(1, &fbo_);
+		glDeleteTextures(1, &color_);
+		eglMakeCurrent(display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglDestroyContext(display_, context_);
+		eglTerminate(display_);
+	}
+
+	HeadlessContext(const HeadlessContext& other) = delete;
+	HeadlessContext& operator=(const HeadlessContext& other) = delete;
+
+	std::string renderer() const {
+		return (const char*)glGetString(GL_RENDERER);
+	}
+};
+
+#endif
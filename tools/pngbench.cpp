@@ -0,0 +1,230 @@
+// Decodes PNGs with lodepng's table driven inflate and SSE2 unfilter and with
+// the original reference code, checks that both produce the same bytes and
+// reports the decode times as JSON.
+//
+//   bin/pngbench res/*.png > png.json
+//
+// Besides the given files, generated images in every color type, with and
+// without Adam7, stored/fixed/dynamic deflate blocks and all five scanline
+// filters are round-tripped through the encoder and both decoders.
+//
+// Options:
+//   --runs N   decodes of every file per decoder, the fastest counts (default 5)
+//
+// Exits with 1 when any decode differs.
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <lodepng.h>
+
+#include <stopwatch.hpp>
+
+namespace
+{
+	// which parts of the fast path are on
+	struct Decoder
+	{
+		const char* name;
+		unsigned fast_inflate;
+		unsigned fast_unfilter;
+	};
+
+	const Decoder reference = { "reference", 0, 0 };
+	const Decoder fast_inflate = { "fast_inflate", 1, 0 };
+	const Decoder fast = { "fast", 1, 1 };
+
+	struct Image
+	{
+		unsigned width = 0, height = 0;
+		std::vector<unsigned char> pixels;
+		unsigned error = 0;
+	};
+
+	Image decode(const Decoder& decoder, const std::vector<unsigned char>& png,
+		LodePNGColorType colortype = LCT_RGBA, unsigned bitdepth = 8) {
+		lodepng::State state;
+		state.decoder.zlibsettings.fast_inflate = decoder.fast_inflate;
+		state.decoder.fast_unfilter = decoder.fast_unfilter;
+		state.info_raw.colortype = colortype;
+		state.info_raw.bitdepth = bitdepth;
+
+		Image image;
+		image.error = lodepng::decode(image.pixels, image.width, image.height, state, png);
+		return image;
+	}
+
+	bool same(const Image& a, const Image& b) {
+		return a.error == b.error && a.width == b.width && a.height == b.height && a.pixels == b.pixels;
+	}
+
+	// Noise mixed with flat runs and gradients, so the encoder finds both
+	// literals and long matches.
+	std::vector<unsigned char> generate(unsigned width, unsigned height, std::size_t bytes_per_pixel, unsigned seed) {
+		std::vector<unsigned char> pixels(width * height * bytes_per_pixel);
+		for (std::size_t i = 0; i < pixels.size(); i++) {
+			seed = seed * 1103515245u + 12345u;
+			std::size_t pixel = i / bytes_per_pixel;
+			std::size_t x = pixel % width, y = pixel / width;
+
+			if (y % 7 < 2) pixels[i] = (unsigned char)(x * 3 + y);
+			else if (x % 11 < 5) pixels[i] = (unsigned char)(i % bytes_per_pixel * 60);
+			else pixels[i] = (unsigned char)(seed >> 16);
+		}
+		return pixels;
+	}
+
+	struct Mode
+	{
+		LodePNGColorType colortype;
+		unsigned bitdepth;
+	};
+
+	// Returns the number of generated images that did not decode to their
+	// own pixels with both decoders.
+	int verify_generated(int& checked) {
+		const Mode modes[] = {
+			{ LCT_RGBA, 8 }, { LCT_RGB, 8 }, { LCT_GREY, 8 }, { LCT_GREY_ALPHA, 8 },
+			{ LCT_RGBA, 16 }, { LCT_RGB, 16 }, { LCT_GREY, 1 }, { LCT_GREY, 4 },
+		};
+
+		int mismatches = 0;
+
+		for (auto&& mode : modes) {
+			for (unsigned interlace = 0; interlace < 2; interlace++) {
+				for (unsigned btype = 0; btype < 3; btype++) {
+					// odd width: sub-byte scanlines end inside a byte
+					const unsigned width = 53, height = 40;
+
+					LodePNGColorMode color;
+					lodepng_color_mode_init(&color);
+					color.colortype = mode.colortype;
+					color.bitdepth = mode.bitdepth;
+					std::size_t raw_size = lodepng_get_raw_size(width, height, &color);
+					lodepng_color_mode_cleanup(&color);
+
+					// generated per byte, sub-byte pixels are just packed noise
+					std::vector<unsigned char> pixels = generate(width, height,
+						std::max<std::size_t>(1, raw_size / (width * height)), checked + 1);
+					pixels.resize(raw_size);
+
+					// every filter type in turn, scanline by scanline
+					std::vector<unsigned char> filters(height);
+					for (unsigned y = 0; y < height; y++) filters[y] = (unsigned char)(y % 5);
+
+					lodepng::State state;
+					state.info_raw.colortype = mode.colortype;
+					state.info_raw.bitdepth = mode.bitdepth;
+					state.info_png.color.colortype = mode.colortype;
+					state.info_png.color.bitdepth = mode.bitdepth;
+					state.info_png.interlace_method = interlace;
+					state.encoder.auto_convert = 0;
+					state.encoder.filter_palette_zero = 0;
+					state.encoder.filter_strategy = LFS_PREDEFINED;
+					state.encoder.predefined_filters = filters.data();
+					state.encoder.zlibsettings.btype = btype;
+
+					std::vector<unsigned char> png;
+					unsigned error = lodepng::encode(png, pixels, width, height, state);
+					if (error) {
+						std::cerr << "ERROR: encoding a test image failed: " << lodepng_error_text(error) << std::endl;
+						throw "encode failed";
+					}
+
+					Image original;
+					original.width = width;
+					original.height = height;
+					original.pixels = pixels;
+
+					checked++;
+					if (!same(decode(reference, png, mode.colortype, mode.bitdepth), original)
+						|| !same(decode(fast, png, mode.colortype, mode.bitdepth), original)) {
+						std::cerr << "ERROR: generated image (color type " << mode.colortype << ", " << mode.bitdepth
+						          << " bits, interlace " << interlace << ", btype " << btype << ") differs" << std::endl;
+						mismatches++;
+					}
+				}
+			}
+		}
+
+		return mismatches;
+	}
+
+	// Fastest of `runs` decodes of all files, in milliseconds.
+	float time_decoder(const Decoder& decoder, const std::vector<std::vector<unsigned char>>& files, int runs) {
+		float best = 0;
+		for (int run = 0; run < runs; run++) {
+			Stopwatch stopwatch;
+			for (auto&& png : files) {
+				decode(decoder, png);
+			}
+			float ms = stopwatch.ms_float();
+			if (run == 0 || ms < best) best = ms;
+		}
+		return best;
+	}
+}
+
+int main(int argc, char** argv) {
+	try {
+		int runs = 5;
+		std::vector<std::string> filenames;
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			if (arg == "--runs" && i + 1 < argc) runs = std::max(1, std::atoi(argv[++i]));
+			else filenames.push_back(arg);
+		}
+
+		std::vector<std::vector<unsigned char>> files;
+		std::size_t bytes = 0;
+		int mismatches = 0;
+
+		for (auto&& filename : filenames) {
+			std::vector<unsigned char> png;
+			unsigned error = lodepng::load_file(png, filename);
+			if (error) {
+				std::cerr << "ERROR: cannot read " << filename << ": " << lodepng_error_text(error) << std::endl;
+				throw "cannot read file";
+			}
+
+			if (!same(decode(reference, png), decode(fast, png))) {
+				std::cerr << "ERROR: " << filename << " decodes differently" << std::endl;
+				mismatches++;
+			}
+
+			bytes += png.size();
+			files.push_back(std::move(png));
+		}
+
+		int generated = 0;
+		mismatches += verify_generated(generated);
+
+		float reference_ms = time_decoder(reference, files, runs);
+		float fast_inflate_ms = time_decoder(fast_inflate, files, runs);
+		float fast_ms = time_decoder(fast, files, runs);
+
+		std::cout
+			<< "{\n"
+			<< "  \"files\": " << files.size() << ",\n"
+			<< "  \"bytes\": " << bytes << ",\n"
+			<< "  \"runs\": " << runs << ",\n"
+			<< "  \"decode_ms\": {\n"
+			<< "    \"" << reference.name << "\": " << reference_ms << ",\n"
+			<< "    \"" << fast_inflate.name << "\": " << fast_inflate_ms << ",\n"
+			<< "    \"" << fast.name << "\": " << fast_ms << "\n"
+			<< "  },\n"
+			<< "  \"speedup\": " << (fast_ms > 0 ? reference_ms / fast_ms : 0) << ",\n"
+			<< "  \"generated_images\": " << generated << ",\n"
+			<< "  \"mismatches\": " << mismatches << "\n"
+			<< "}" << std::endl;
+
+		return mismatches ? 1 : 0;
+	} catch (const char* error) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+}
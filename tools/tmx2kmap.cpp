@@ -0,0 +1,25 @@
+// Converts a Tiled .tmx map into the binary .kmap format that the game maps
+// at startup instead of parsing XML.
+//
+//   bin/tmx2kmap xmlova.tmx xmlova.kmap
+
+#include <iostream>
+
+#include <tiled.hpp>
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cerr << "usage: " << argv[0] << " input.tmx output.kmap" << std::endl;
+		return 1;
+	}
+
+	try {
+		TileMap map = load_tiles(argv[1]);
+		save_binary_map(map, argv[2]);
+	} catch (const char* error) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,293 @@
+// Generates a square map in every <data> variant Tiled writes, times
+// load_tiles() on each and, on <tile> elements, the boost::property_tree
+// loader it replaced. Reports the times as JSON.
+//
+//   bin/tmxbench > tmx.json
+//
+// Options:
+//   --size N        cells per side (default 4096)
+//   --runs N        loads of every map per loader, the fastest counts
+//                   (default 3)
+//   --no-reference  skip the property_tree loader, it builds three nodes
+//                   for every cell, about 1.2 KB, which is some 19 GB at
+//                   4096x4096
+//
+// The maps are written as tmxbench_<variant>.tmx into the current directory
+// and removed afterwards. Exits with 1 when a loader reads a wrong gid.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+
+#include <lodepng.h>
+
+#include <stopwatch.hpp>
+#include <tiled.hpp>
+
+namespace
+{
+	const int tileset_size = 16;
+
+	struct Options
+	{
+		int size = 4096;
+		int runs = 3;
+		bool reference = true;
+	};
+
+	Options parse_options(int argc, char** argv) {
+		Options options;
+
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+
+			if (arg == "--no-reference") {
+				options.reference = false;
+				continue;
+			}
+
+			if (i + 1 >= argc) {
+				std::cerr << "ERROR: missing value for " << arg << std::endl;
+				throw "missing option value";
+			}
+
+			const char* value = argv[++i];
+
+			if (arg == "--size") options.size = std::atoi(value);
+			else if (arg == "--runs") options.runs = std::atoi(value);
+			else {
+				std::cerr << "ERROR: unknown option " << arg << std::endl;
+				throw "unknown option";
+			}
+		}
+
+		if (options.size <= 0 || options.runs <= 0) {
+			std::cerr << "ERROR: --size and --runs must be positive" << std::endl;
+			throw "invalid option";
+		}
+
+		return options;
+	}
+
+	// The loader before the pull parser, from the first layer of the map.
+	std::vector<int> load_reference(const std::string& filename) {
+		namespace pt = boost::property_tree;
+
+		pt::ptree tree;
+		pt::read_xml(filename, tree);
+
+		std::vector<Tile> tiles;
+		for (auto& x : tree.get_child("map.tileset")) {
+			if (x.first != "tile") continue;
+
+			auto& image = x.second.get_child("image");
+			tiles.push_back({
+				x.second.get<int>("<xmlattr>.id"),
+				image.get<int>("<xmlattr>.width"),
+				image.get<int>("<xmlattr>.height"),
+				image.get<std::string>("<xmlattr>.source")
+			});
+		}
+
+		std::vector<int> gids;
+		for (auto& tile : tree.get_child("map.layer.data")) {
+			if (tile.first == "tile") gids.push_back(tile.second.get<int>("<xmlattr>.gid"));
+		}
+
+		return gids;
+	}
+
+	// every 8th cell empty, the rest spread over the tileset
+	std::vector<int> generate_gids(int size) {
+		std::vector<int> gids((std::size_t)size * size);
+
+		std::uint32_t state = 12345;
+		for (auto&& gid : gids) {
+			state = state * 1664525u + 1013904223u;
+			int r = (int)(state >> 16);
+			gid = r % 8 == 0 ? 0 : 1 + r / 8 % tileset_size;
+		}
+
+		return gids;
+	}
+
+	std::string base64(const std::vector<unsigned char>& bytes) {
+		static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+		std::string out;
+		out.reserve((bytes.size() + 2) / 3 * 4);
+
+		for (std::size_t i = 0; i < bytes.size(); i += 3) {
+			std::uint32_t n = (std::uint32_t)bytes[i] << 16;
+			if (i + 1 < bytes.size()) n |= (std::uint32_t)bytes[i + 1] << 8;
+			if (i + 2 < bytes.size()) n |= bytes[i + 2];
+
+			out += digits[n >> 18 & 63];
+			out += digits[n >> 12 & 63];
+			out += i + 1 < bytes.size() ? digits[n >> 6 & 63] : '=';
+			out += i + 2 < bytes.size() ? digits[n & 63] : '=';
+		}
+
+		return out;
+	}
+
+	// Writes the map with its layer in `variant`: "tile", "csv", "base64" or
+	// "base64_zlib". Returns the file size.
+	std::size_t write_map(const std::string& filename, const std::string& variant, int size, const std::vector<int>& gids) {
+		std::ofstream out(filename, std::ios::binary);
+		if (!out) {
+			std::cerr << "ERROR: failed to open " << filename << " for writing" << std::endl;
+			throw "Failed to write map";
+		}
+
+		out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+		    << "<map version=\"1.0\" orientation=\"orthogonal\" renderorder=\"right-down\" width=\"" << size
+		    << "\" height=\"" << size << "\" tilewidth=\"32\" tileheight=\"32\">\n"
+		    << " <tileset firstgid=\"1\" name=\"bench\" tilewidth=\"32\" tileheight=\"32\" tilecount=\""
+		    << tileset_size << "\" columns=\"0\">\n";
+		for (int id = 0; id < tileset_size; id++) {
+			out << "  <tile id=\"" << id << "\">\n"
+			    << "   <image width=\"32\" height=\"32\" source=\"tile_" << id << ".png\"/>\n"
+			    << "  </tile>\n";
+		}
+		out << " </tileset>\n"
+		    << " <layer name=\"ground\" width=\"" << size << "\" height=\"" << size << "\">\n";
+
+		if (variant == "tile") {
+			out << "  <data>\n";
+			for (int gid : gids) out << "   <tile gid=\"" << gid << "\"/>\n";
+		} else if (variant == "csv") {
+			out << "  <data encoding=\"csv\">\n";
+			for (std::size_t i = 0; i < gids.size(); i++) {
+				out << gids[i];
+				if (i + 1 < gids.size()) out << ((i + 1) % size ? "," : ",\n");
+			}
+			out << "\n";
+		} else {
+			// little-endian 32-bit gids
+			std::vector<unsigned char> bytes(gids.size() * 4);
+			for (std::size_t i = 0; i < gids.size(); i++) {
+				for (int b = 0; b < 4; b++) bytes[i * 4 + b] = (unsigned char)((std::uint32_t)gids[i] >> (8 * b));
+			}
+
+			if (variant == "base64_zlib") {
+				std::vector<unsigned char> compressed;
+				unsigned error = lodepng::compress(compressed, bytes);
+				if (error) {
+					std::cerr << "ERROR: zlib compression failed: " << lodepng_error_text(error) << std::endl;
+					throw "zlib compression failed";
+				}
+				bytes.swap(compressed);
+				out << "  <data encoding=\"base64\" compression=\"zlib\">\n";
+			} else {
+				out << "  <data encoding=\"base64\">\n";
+			}
+			out << "   " << base64(bytes) << "\n";
+		}
+
+		out << "  </data>\n"
+		    << " </layer>\n"
+		    << "</map>\n";
+
+		std::size_t bytes = (std::size_t)out.tellp();
+		if (!out) {
+			std::cerr << "ERROR: failed to write " << filename << std::endl;
+			throw "Failed to write map";
+		}
+		return bytes;
+	}
+
+	struct Sample
+	{
+		std::string variant;
+		std::size_t bytes;
+		float pull_ms;
+		// < 0 when not measured
+		float reference_ms = -1;
+	};
+
+	template <typename F>
+	float fastest(int runs, F load) {
+		float best = 0;
+		for (int run = 0; run < runs; run++) {
+			Stopwatch stopwatch;
+			load();
+			float ms = stopwatch.ms_float();
+			if (run == 0 || ms < best) best = ms;
+		}
+		return best;
+	}
+}
+
+int main(int argc, char** argv) {
+	bool failed = false;
+	std::vector<Sample> samples;
+	Options options;
+
+	try {
+		options = parse_options(argc, argv);
+		std::vector<int> gids = generate_gids(options.size);
+
+		for (const char* variant : { "tile", "csv", "base64", "base64_zlib" }) {
+			std::string filename = std::string("tmxbench_") + variant + ".tmx";
+
+			Sample sample;
+			sample.variant = variant;
+			sample.bytes = write_map(filename, variant, options.size, gids);
+
+			TileMap map;
+			sample.pull_ms = fastest(options.runs, [&] { map = load_tiles(filename); });
+			if (!std::equal(gids.begin(), gids.end(), map.layers[0].gids.begin())) {
+				std::cerr << "ERROR: load_tiles read wrong gids from " << filename << std::endl;
+				failed = true;
+			}
+
+			if (options.reference && sample.variant == "tile") {
+				std::vector<int> reference;
+				sample.reference_ms = fastest(options.runs, [&] { reference = load_reference(filename); });
+				if (reference != gids) {
+					std::cerr << "ERROR: the reference loader read wrong gids from " << filename << std::endl;
+					failed = true;
+				}
+			}
+
+			std::remove(filename.c_str());
+			samples.push_back(sample);
+		}
+	} catch (const char* error) {
+		std::cerr << error << std::endl;
+		return 1;
+	}
+
+	std::cout
+		<< "{\n"
+		<< "  \"size\": " << options.size << ",\n"
+		<< "  \"runs\": " << options.runs << ",\n"
+		<< "  \"maps\": [";
+
+	for (std::size_t i = 0; i < samples.size(); i++) {
+		auto&& sample = samples[i];
+		std::cout
+			<< (i ? ",\n" : "\n")
+			<< "    {\"variant\": \"" << sample.variant << "\""
+			<< ", \"bytes\": " << sample.bytes
+			<< ", \"pull_ms\": " << sample.pull_ms;
+		if (sample.reference_ms >= 0) {
+			std::cout
+				<< ", \"reference_ms\": " << sample.reference_ms
+				<< ", \"speedup\": " << sample.reference_ms / std::max(sample.pull_ms, 0.001f);
+		}
+		std::cout << "}";
+	}
+
+	std::cout << "\n  ]\n}" << std::endl;
+
+	return failed ? 1 : 0;
+}